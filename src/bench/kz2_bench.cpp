@@ -0,0 +1,492 @@
+/**
+ * @file kz2_bench.cpp
+ * @brief Benchmark of KZ2 on synthetic or reference stereo pairs
+ * @author Pascal Monasse <monasse@imagine.enpc.fr>
+ *
+ * Copyright (c) 2026, Pascal Monasse
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Pulic License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "match.h"
+#include "cmdLine.h"
+#include "timer.h"
+#include "nan.h"
+#include <algorithm>
+#include <vector>
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+/// Peak resident memory of the process so far, in KiB (-1 if unknown).
+static long peak_memory() {
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#ifdef __APPLE__
+    return usage.ru_maxrss/1024; // bytes
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+/// Hash of integers, for value noise independent of the platform's rand().
+static unsigned int hash(unsigned int a, unsigned int b, unsigned int c) {
+    unsigned int h = a*0x9E3779B1u ^ b*0x85EBCA77u ^ c*0xC2B2AE3Du;
+    h ^= h>>15; h *= 0x2C1B3C6Du;
+    h ^= h>>12; h *= 0x297A2D39u;
+    h ^= h>>15;
+    return h;
+}
+
+/// Linear congruential generator, for reproducible scenes.
+class Random {
+    unsigned int s;
+public:
+    explicit Random(unsigned int seed): s(seed) {}
+    /// Uniform in [0,1)
+    float uniform() {
+        s = s*1103515245u + 12345u;
+        return (s>>8)/16777216.0f;
+    }
+    /// Uniform in [a,b)
+    float uniform(float a, float b) { return a+(b-a)*uniform(); }
+};
+
+/// Synthetic piecewise-planar scene: rectangles in front of a background.
+class Scene {
+public:
+    /// Planar layer: disparity d(x,y)=a*x+b*y+c inside rectangle.
+    struct Layer {
+        int x0, y0, x1, y1; ///< Rectangle [x0,x1)x[y0,y1)
+        float a, b, c;      ///< Disparity plane
+        int disp(int x, int y, int dMin, int dMax) const {
+            int d = (int)std::floor(a*x+b*y+c+.5f);
+            return std::max(dMin, std::min(dMax, d));
+        }
+    };
+    Scene(int w, int h, int dMin, int dMax, int nPlanes, int texture,
+          unsigned int seed);
+    void render(GeneralImage left, GeneralImage right, FloatImage gt) const;
+private:
+    int w, h, dMin, dMax, texture;
+    unsigned int seed;
+    std::vector<Layer> layers; ///< Back to front
+    int value(int layer, int x, int y, int channel) const;
+    template <class Im>
+    void render(Im left, Im right, FloatImage gt) const;
+};
+
+/// Random scene: background plane and \a nPlanes rectangles, slanted planes.
+/// The \a texture is the period in pixels of the value noise of the surfaces.
+Scene::Scene(int w0, int h0, int dMin0, int dMax0, int nPlanes, int texture0,
+             unsigned int seed0)
+: w(w0), h(h0), dMin(dMin0), dMax(dMax0), texture(texture0), seed(seed0) {
+    Random rnd(seed);
+    const float range = (float)(dMax-dMin);
+    for(int i=0; i<=nPlanes; i++) {
+        Layer l;
+        if(i==0) { // Background
+            l.x0 = l.y0 = 0; l.x1 = w; l.y1 = h;
+        } else {
+            int sx = (int)rnd.uniform(w/8.0f, w/3.0f);
+            int sy = (int)rnd.uniform(h/8.0f, h/3.0f);
+            l.x0 = (int)rnd.uniform(0, (float)(w-sx));
+            l.y0 = (int)rnd.uniform(0, (float)(h-sy));
+            l.x1 = l.x0+sx; l.y1 = l.y0+sy;
+        }
+        // Slope at most a quarter of the range across the layer
+        l.a = rnd.uniform(-.125f,.125f)*range/(l.x1-l.x0);
+        l.b = rnd.uniform(-.125f,.125f)*range/(l.y1-l.y0);
+        float cx=.5f*(l.x0+l.x1), cy=.5f*(l.y0+l.y1);
+        l.c = rnd.uniform((float)dMin, (float)dMax+1) - l.a*cx - l.b*cy;
+        layers.push_back(l);
+    }
+}
+
+/// Value noise of surface \a layer, bilinear interpolation of random values.
+int Scene::value(int layer, int x, int y, int channel) const {
+    int i=x/texture, j=y/texture;
+    float u=(x-i*texture)/(float)texture, v=(y-j*texture)/(float)texture;
+    unsigned int s = seed + 1013u*layer + 7u*channel;
+    float v00=(float)(hash(s,i,j)&255),   v10=(float)(hash(s,i+1,j)&255);
+    float v01=(float)(hash(s,i,j+1)&255), v11=(float)(hash(s,i+1,j+1)&255);
+    return (int)((1-v)*((1-u)*v00+u*v10) + v*((1-u)*v01+u*v11) + .5f);
+}
+
+template <class Im>
+void Scene::render(Im left, Im right, FloatImage gt) const {
+    typedef PixelTraits<Im> T;
+    const int scale = (T::bits==16)? 257: 1;
+    const Coord size(w,h);
+    IntImage owner = (IntImage)imNew(IMAGE_INT, size); // layer visible in right
+    IntImage source= (IntImage)imNew(IMAGE_INT, size); // abscissa in left
+    IntImage top   = (IntImage)imNew(IMAGE_INT, size); // layer visible in left
+
+    RectIterator end=rectEnd(size);
+    for(RectIterator p=rectBegin(size); p!=end; ++p) {
+        IMREF(owner,*p) = IMREF(source,*p) = IMREF(top,*p) = -1;
+        for(int c=0; c<T::channels; c++) // Unseen surface in left image
+            T::at(right,*p,c) = (typename T::Channel)
+                (scale*value((int)layers.size(),(*p).x,(*p).y,c));
+    }
+    // Painter's algorithm, back to front
+    for(int k=0; k<(int)layers.size(); k++) {
+        const Layer& l = layers[k];
+        for(int y=l.y0; y<l.y1; y++)
+            for(int x=l.x0; x<l.x1; x++) {
+                imRef(top,x,y) = k;
+                int xr = x+l.disp(x,y,dMin,dMax);
+                if(xr<0 || xr>=w) continue;
+                imRef(owner,xr,y) = k;
+                imRef(source,xr,y) = x;
+                for(int c=0; c<T::channels; c++)
+                    T::at(right,Coord(xr,y),c) = (typename T::Channel)
+                        (scale*value(k,x,y,c));
+            }
+    }
+    for(RectIterator p=rectBegin(size); p!=end; ++p) {
+        int k = IMREF(top,*p);
+        for(int c=0; c<T::channels; c++)
+            T::at(left,*p,c) = (typename T::Channel)
+                (scale*value(k,(*p).x,(*p).y,c));
+        int d = layers[k].disp((*p).x,(*p).y,dMin,dMax);
+        Coord q = *p+d;
+        bool visible = inRect(q,size) &&
+            IMREF(owner,q)==k && IMREF(source,q)==(*p).x;
+        IMREF(gt,*p) = visible? (float)d: NaN;
+    }
+    imFree(owner);
+    imFree(source);
+    imFree(top);
+}
+
+/// Render the scene in images of same type. Occluded pixels are NaN in \a gt.
+void Scene::render(GeneralImage left, GeneralImage right, FloatImage gt) const {
+    switch(imGetType(left)) {
+    case IMAGE_GRAY:  render((GrayImage)  left,(GrayImage)  right,gt); break;
+    case IMAGE_RGB:   render((RGBImage)   left,(RGBImage)   right,gt); break;
+    case IMAGE_GRAY16:render((Gray16Image)left,(Gray16Image)right,gt); break;
+    case IMAGE_RGB16: render((RGB16Image) left,(RGB16Image) right,gt); break;
+    default: break;
+    }
+}
+
+/// Fraction of pixels visible in \a gt whose disparity is wrong by more than
+/// one pixel or that are declared occluded.
+static float bad_pixels(FloatImage disp, FloatImage gt) {
+    const Coord size(imGetXSize(gt), imGetYSize(gt));
+    int n=0, bad=0;
+    RectIterator end=rectEnd(size);
+    for(RectIterator p=rectBegin(size); p!=end; ++p)
+        if(is_number(IMREF(gt,*p))) {
+            ++n;
+            float d = IMREF(disp,*p);
+            if(!is_number(d) || std::abs(d-IMREF(gt,*p))>1)
+                ++bad;
+        }
+    return n? bad/(float)n: 0;
+}
+
+/// Name of image type
+static const char* type_name(ImageType type) {
+    switch(type) {
+    case IMAGE_GRAY:   return "gray";
+    case IMAGE_RGB:    return "rgb";
+    case IMAGE_GRAY16: return "gray16";
+    case IMAGE_RGB16:  return "rgb16";
+    default: return "other";
+    }
+}
+
+/// Timing of a pipeline stage over repetitions.
+struct Stage {
+    const char* name;
+    std::vector<double> t;
+    long memory; ///< Peak memory at end of stage (KiB)
+    explicit Stage(const char* s): name(s), memory(-1) {}
+    double min() const { return *std::min_element(t.begin(), t.end()); }
+    double mean() const {
+        double s=0;
+        for(size_t i=0; i<t.size(); i++) s += t[i];
+        return s/t.size();
+    }
+};
+
+/// Output stages as JSON object
+static std::ostream& operator<<(std::ostream& str,
+                                const std::vector<Stage>& stages) {
+    str << '{';
+    for(size_t i=0; i<stages.size(); i++)
+        str << (i? ", ": "") << '"' << stages[i].name << "\": {"
+            << "\"min_s\": " << stages[i].min() << ", "
+            << "\"mean_s\": " << stages[i].mean() << ", "
+            << "\"peak_kib\": " << stages[i].memory << '}';
+    return str << '}';
+}
+
+/// Output a string as JSON value, escaping the necessary characters.
+static std::string json_string(const std::string& s) {
+    std::string out="\"";
+    for(size_t i=0; i<s.size(); i++) {
+        if(s[i]=='"' || s[i]=='\\') out += '\\';
+        out += s[i];
+    }
+    return out+'"';
+}
+
+/// Main program
+int main(int argc, char *argv[]) {
+    Match::Parameters params = { // Default parameters, as in KZ2
+        Match::Parameters::L2, 30, 1, // dataCost, cutoff, denominator
+        8, -1, -1, // edgeThresh, lambda1, lambda2 (smoothness cost)
+        -1,        // K (occlusion cost)
+        4, false,  // maxIter, bRandomizeEveryIteration
+        false, false, // bInitWTA, bFusion
+        1, 1       // rangeSize, parallelMoves
+    };
+
+    CmdLine cmd;
+    int w=320, h=240, dMin=-16, dMax=0, nPlanes=8, texture=4, reps=3;
+    int seed=1, rangeMargin=-1;
+    float kSample=1, outliers=0.01f;
+    bool color=false, deep=false, tiles=false, reduce=false, help=false;
+    std::string cost, save;
+    cmd.add( make_option('h', help, "help") );
+    cmd.add( make_option('x', w, "width") );
+    cmd.add( make_option('y', h, "height") );
+    cmd.add( make_option(0, dMin, "dmin") );
+    cmd.add( make_option(0, dMax, "dmax") );
+    cmd.add( make_option('p', nPlanes, "planes") );
+    cmd.add( make_option('t', texture, "texture") );
+    cmd.add( make_option(0, color, "color") );
+    cmd.add( make_option(0, deep, "deep") );
+    cmd.add( make_option('n', reps, "repeat") );
+    cmd.add( make_option('s', seed, "seed") );
+    cmd.add( make_option(0, save, "save") );
+    cmd.add( make_option('i', params.maxIter, "max_iter") );
+    cmd.add( make_option('c', cost, "data_cost") );
+    cmd.add( make_option(0, kSample, "k_sample") );
+    cmd.add( make_option(0, rangeMargin, "auto_range") );
+    cmd.add( make_option(0, outliers, "outliers") );
+    cmd.add( make_option(0, params.bInitWTA, "wta") );
+    cmd.add( make_option(0, params.bFusion, "fusion") );
+    cmd.add( make_option(0, params.rangeSize, "range") );
+    cmd.add( make_option(0, params.parallelMoves, "parallel") );
+    cmd.add( make_option(0, tiles, "tiles") );
+    cmd.add( make_option(0, reduce, "reduce") );
+
+    try {
+        cmd.process(argc, argv);
+    } catch(const std::string& str) {
+        std::cerr << str << std::endl;
+        argc = 0; // Display usage
+    }
+    if(help || (argc!=1 && argc!=5) || w<=0 || h<=0 || nPlanes<0 ||
+       texture<=0 || reps<=0 || kSample<=0 || kSample>1 ||
+       params.rangeSize<1 || params.parallelMoves<1 ||
+       outliers<0 || outliers>=0.5f) {
+        std::ostream& out = help? std::cout: std::cerr;
+        out << "Usage: " << argv[0] << " [options] "
+            << "[im1.png im2.png dMin dMax]" << std::endl;
+        out << "Without images, benchmark on synthetic scene:" << '\n'
+            << " -x,--width w: image width (320)" <<'\n'
+            << " -y,--height h: image height (240)" <<'\n'
+            << " --dmin d, --dmax d: disparity range (-16 0)" <<'\n'
+            << " -p,--planes n: number of planes (8) over background"
+            <<'\n'
+            << " -t,--texture t: period in pixels of texture (4)" <<'\n'
+            << " --color: color images" <<'\n'
+            << " --deep: 16-bit images" <<'\n'
+            << " --save prefix: save pair and ground truth, not with"
+            << " --deep" <<'\n'
+            << "General options:" << '\n'
+            << " -h,--help: print this message" <<'\n'
+            << " -n,--repeat n: number of runs (3)" <<'\n'
+            << " -s,--seed s: random seed of scene and alpha order (1)"
+            <<'\n'
+            << " -i,--max_iter iter: max number of iterations" <<'\n'
+            << " -c,--data_cost dist: L1 or L2" <<'\n'
+            << " --k_sample f: estimate K from fraction f of pixels"
+            <<'\n'
+            << " --auto_range m: restrict disparity range to sparse"
+            << " matches, with margin m" <<'\n'
+            << " --outliers f: fraction of sparse matches ignored at"
+            << " each end (0.01)" <<'\n'
+            << " --wta: initialize by winner-take-all" <<'\n'
+            << " --fusion: fusion moves before alpha-expansions" <<'\n'
+            << " --range r: moves over r labels before alpha-expansions"
+            <<'\n'
+            << " --parallel n: n concurrent alpha-expansions" <<'\n'
+            << " --tiles: graph nodes numbered by tiles of pixels" <<'\n'
+            << " --reduce: fix graph nodes of known value before max-flow"
+            << std::endl;
+        return help? 0: 1;
+    }
+    if(deep && ! save.empty()) {
+        std::cerr << "Unable to save 16-bit images: --save is not available"
+                  << " with --deep" << std::endl;
+        return 1;
+    }
+    if( cmd.used('c') ) {
+        if(cost == "L1")
+            params.dataCost = Match::Parameters::L1;
+        else if(cost == "L2")
+            params.dataCost = Match::Parameters::L2;
+        else {
+            std::cerr << "The cost parameter must be 'L1' or 'L2'" << std::endl;
+            return 1;
+        }
+    }
+
+    GeneralImage im1=0, im2=0;
+    FloatImage gt=0;
+    std::string pair="synthetic";
+    if(argc == 5) { // Reference pair
+        pair = argv[1];
+        im1 = (GeneralImage)imLoadGrayOrRGB(argv[1]);
+        im2 = (GeneralImage)imLoadGrayOrRGB(argv[2]);
+        if(!im1 || !im2) {
+            std::cerr << "Unable to read image " << argv[im1?2:1] << std::endl;
+            return 1;
+        }
+        imConvertPair(im1, im2);
+        std::istringstream f(argv[3]), g(argv[4]);
+        if(! ((f>>dMin).eof() && (g>>dMax).eof())) {
+            std::cerr << "Error reading dMin or dMax" << std::endl;
+            return 1;
+        }
+    } else {
+        if(dMin>dMax) {
+            std::cerr << "Error: wrong disparity range!" << std::endl;
+            return 1;
+        }
+        ImageType type = deep? (color? IMAGE_RGB16: IMAGE_GRAY16):
+                               (color? IMAGE_RGB:   IMAGE_GRAY);
+        im1 = (GeneralImage)imNew(type, w, h);
+        im2 = (GeneralImage)imNew(type, w, h);
+        gt = (FloatImage)imNew(IMAGE_FLOAT, w, h);
+        Scene(w, h, dMin, dMax, nPlanes, texture, seed).render(im1, im2, gt);
+        if(! save.empty() &&
+           (imSave(im1, (save+"_l.png").c_str())!=0 ||
+            imSave(im2, (save+"_r.png").c_str())!=0 ||
+            imSave(gt, (save+"_gt.tif").c_str())!=0))
+            std::cerr << "Unable to save synthetic pair" << std::endl;
+    }
+    const int width=imGetXSize(im1), height=imGetYSize(im1);
+
+    std::vector<Stage> stages;
+    stages.push_back(Stage("setup"));  // Allocation and SubPixel images
+    stages.push_back(Stage("range"));  // Estimation of disparity range
+    stages.push_back(Stage("get_k"));  // Automatic computation of K
+    stages.push_back(Stage("kz2"));    // Alpha-expansions
+    stages.push_back(Stage("init"));   // WTA and proposals, part of kz2
+    stages.push_back(Stage("build"));  // Graph construction, part of kz2
+    stages.push_back(Stage("maxflow"));// Max-flow, part of kz2
+    stages.push_back(Stage("update")); // Disparity update, part of kz2
+    Match::Stats stats;
+    float K=-1, bad=-1;
+    int dMinEst=dMin, dMaxEst=dMax; // Estimated disparity range
+
+    // Peak memory is that of first run
+    for(int r=0; r<reps; r++) {
+        double t0 = elapsed_time();
+        Match m(im1, im2);
+        m.SetDispRange(dMin, dMax);
+        m.SetSeed((unsigned int)seed);
+        m.SetNodeOrder(tiles? Match::ORDER_TILES: Match::ORDER_RASTER);
+        m.SetGraphReduction(reduce);
+        m.SetLog(0); // No progress messages
+        m.SetParameters(&params);
+        double t1 = elapsed_time();
+        if(r==0) stages[0].memory = peak_memory();
+        if(rangeMargin>=0)
+            m.EstimateDispRange(rangeMargin, outliers);
+        dMinEst = m.GetDispMin();
+        dMaxEst = m.GetDispMax();
+        double t2 = elapsed_time();
+        if(r==0) stages[1].memory = peak_memory();
+        Match::Parameters p = params;
+        float lambda=-1, lambda1=-1, lambda2=-1;
+        K=-1;
+        fix_parameters(m, p, K, lambda, lambda1, lambda2, kSample);
+        double t3 = elapsed_time();
+        if(r==0) stages[2].memory = peak_memory();
+        m.KZ2();
+        double t4 = elapsed_time();
+        if(r==0) stages[3].memory = peak_memory();
+
+        stats = m.GetStats();
+        stages[0].t.push_back(t1-t0);
+        stages[1].t.push_back(t2-t1);
+        stages[2].t.push_back(t3-t2);
+        stages[3].t.push_back(t4-t3);
+        stages[4].t.push_back(stats.tInit);
+        stages[5].t.push_back(stats.tBuild);
+        stages[6].t.push_back(stats.tMaxflow);
+        stages[7].t.push_back(stats.tUpdate);
+        if(gt) {
+            FloatImage disp = m.GetXLeft();
+            bad = bad_pixels(disp, gt);
+            imFree(disp);
+        }
+    }
+    for(size_t i=4; i<stages.size(); i++)
+        stages[i].memory = stages[3].memory;
+
+    // The time of kz2 is proportional to the number of labels, the one saved
+    // by the estimation of the range is extrapolated.
+    const int labels=dMax-dMin+1, labelsEst=dMaxEst-dMinEst+1;
+    const double saved = stages[3].min()*(labels-labelsEst)/labelsEst;
+
+    const double pixels = (double)width*height;
+    std::cout << "{\"pair\": " << json_string(pair) << ", "
+              << "\"width\": " << width << ", \"height\": " << height << ", "
+              << "\"labels\": " << labels << ", "
+              << "\"type\": \"" << type_name(imGetType(im1)) << "\", "
+              << "\"seed\": " << seed << ", \"repeat\": " << reps << ", "
+              << "\"wta\": " << (params.bInitWTA? "true": "false") << ", "
+              << "\"fusion\": " << (params.bFusion? "true": "false") << ", "
+              << "\"range\": " << params.rangeSize << ", "
+              << "\"parallel\": " << params.parallelMoves << ", "
+              << "\"tiles\": " << (tiles? "true": "false") << ", "
+              << "\"reduce\": " << (reduce? "true": "false") << ", "
+              << "\"auto_range\": " << (rangeMargin>=0? "true": "false") << ", "
+              << "\"dmin\": " << dMinEst << ", \"dmax\": " << dMaxEst << ", "
+              << "\"kz2_saved_s\": " << saved << ", "
+              << "\"K\": " << K << ", "
+              << "\"energy\": " << stats.E << ", "
+              << "\"moves\": " << stats.moves << ", "
+              << "\"accepted\": " << stats.accepted << ", "
+              << "\"fusions\": " << stats.fusions << ", "
+              << "\"changes\": " << stats.changes << ", "
+              << "\"iterations\": " << stats.iterations << ", "
+              << "\"growths\": " << stats.growths << ", "
+              << "\"augmentations\": " << stats.augmentations << ", "
+              << "\"orphans\": " << stats.orphans << ", "
+              << "\"fixed\": " << stats.fixed << ", "
+              << "\"mpixel_labels_per_s\": "
+              << stats.moves*pixels/stages[3].min()*1e-6 << ", "
+              << "\"bad1\": ";
+    if(gt) std::cout << bad; else std::cout << "null";
+    std::cout << ", \"stages\": " << stages << '}' << std::endl;
+
+    imFree(im1);
+    imFree(im2);
+    imFree(gt);
+    return 0;
+}
@@ -0,0 +1,124 @@
+/**
+ * @file maxflow_bench.cpp
+ * @brief Benchmark of max-flow on graphs saved by KZ2 --dump_graphs
+ * @author Pascal Monasse <monasse@imagine.enpc.fr>
+ *
+ * Copyright (c) 2026, Pascal Monasse
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Pulic License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "energy.h"
+#include "cmdLine.h"
+#include "timer.h"
+#include <cstdio>
+#include <iostream>
+
+/// Same types as Energy and LargeEnergy
+typedef Graph<short,short,Energy::TotalValue,Energy::Var> Graph3;
+typedef Graph<short,short,LargeEnergy::TotalValue,LargeEnergy::Var> Graph3L;
+
+/// Accumulated statistics over all graphs
+struct Totals {
+    double time;
+    long growths, augmentations, orphans, fixed;
+};
+
+/// Size of index type stored in header of graph file, 0 if unreadable.
+static int index_size(const char* fileName) {
+    FILE* f = fopen(fileName, "rb");
+    if(!f) return 0;
+    unsigned char header[8]; // Magic number and sizes of types
+    bool ok = (fread(header, 1, 8, f) == 8);
+    fclose(f);
+    return ok? header[4]: 0;
+}
+
+/// Run maxflow \a reps times on graph in \a fileName, output JSON line and
+/// accumulate in \a totals. Return whether the graph could be loaded.
+template <class G>
+bool bench_graph(const char* fileName, int reps, bool reduce, Totals& totals) {
+    G g;
+    if(! g.load(fileName))
+        return false;
+    double tMin=0, tSum=0;
+    long long flow=0;
+    typename G::Stats stats = {0, 0, 0, 0};
+    for(int r=0; r<reps; r++) {
+        G h(g); // maxflow modifies the graph
+        double t0 = elapsed_time();
+        if(reduce)
+            h.reduce();
+        flow = h.maxflow();
+        double t = elapsed_time()-t0;
+        tSum += t;
+        if(r==0 || t<tMin) tMin = t;
+        stats = h.get_stats();
+    }
+    totals.time += tMin;
+    totals.growths += stats.growths;
+    totals.augmentations += stats.augmentations;
+    totals.orphans += stats.orphans;
+    totals.fixed += stats.fixed;
+    std::cout << "{\"graph\": \"" << fileName << "\", "
+              << "\"flow\": " << flow << ", "
+              << "\"min_s\": " << tMin << ", "
+              << "\"mean_s\": " << tSum/reps << ", "
+              << "\"growths\": " << stats.growths << ", "
+              << "\"augmentations\": " << stats.augmentations << ", "
+              << "\"orphans\": " << stats.orphans << ", "
+              << "\"fixed\": " << stats.fixed << '}' << std::endl;
+    return true;
+}
+
+/// Main program
+int main(int argc, char *argv[]) {
+    CmdLine cmd;
+    int reps=5;
+    bool reduce=false;
+    cmd.add( make_option('n', reps, "repeat") );
+    cmd.add( make_option('r', reduce, "reduce") );
+    try {
+        cmd.process(argc, argv);
+    } catch(const std::string& str) {
+        std::cerr << str << std::endl;
+        argc = 0; // Display usage
+    }
+    if(argc<2 || reps<=0) {
+        std::cerr << "Usage: " << argv[0] << " [options] "
+                  << "graph1 [graph2 ...]" << std::endl;
+        std::cerr << "Graphs are saved by KZ2 --dump_graphs" << '\n'
+                  << " -n,--repeat n: number of runs per graph (5)" <<'\n'
+                  << " -r,--reduce: fix nodes of known segment before maxflow"
+                  << std::endl;
+        return 1;
+    }
+
+    // One JSON line per graph, then total
+    Totals totals = {0, 0, 0, 0, 0};
+    for(int i=1; i<argc; i++) {
+        bool ok=false;
+        if(index_size(argv[i]) == sizeof(Graph3L::node_id))
+            ok = bench_graph<Graph3L>(argv[i], reps, reduce, totals);
+        else
+            ok = bench_graph<Graph3>(argv[i], reps, reduce, totals);
+        if(! ok) {
+            std::cerr << "Unable to load graph " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "{\"graphs\": " << argc-1 << ", "
+              << "\"min_s\": " << totals.time << ", "
+              << "\"growths\": " << totals.growths << ", "
+              << "\"augmentations\": " << totals.augmentations << ", "
+              << "\"orphans\": " << totals.orphans << ", "
+              << "\"fixed\": " << totals.fixed << '}' << std::endl;
+    return 0;
+}
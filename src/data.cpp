@@ -19,118 +19,40 @@
 /*
 Functions depending on input images:
 
-data_penalty_X(Coord p, Coord q)
-smoothness_penalty_X(Coord p1, Coord p2, Coord disp)
+data_penalty<Im,Norm>(Coord p, Coord q)
 
-where X describes the appropriate case (gray/color)
+where Im describes the appropriate case (gray/color, 8/16 bits) and Norm the
+data cost (L1/L2). It is defined in penalty.h, so that it is inlined in the
+specialized graph construction. The smoothness penalty reads bitmaps of edges,
+computed once from the images.
 */
 
-#include "match.h"
+#include "penalty.h"
 #include <algorithm>
+#include <cassert>
+#include <cstdlib>
 
-/************************************************************/
-/********************* data penalty *************************/
-/************************************************************/
-// The data term is computed as described in
-//   Stan Birchfield and Carlo Tomasi
-//   "A pixel dissimilarity measure that is insensitive to image sampling"
-//   IEEE Trans. on PAMI 20(4):401-406, April 98
-// with one distinction: intensity intervals for a pixels
-// are computed from 4 neighbors rather than 2.
-
-/// Upper bound for intensity level difference when computing data cost
-static int CUTOFF=30;
-
-/// Distance from v to interval [min,max]
-inline int dist_interval(int v, int min, int max) {
-    if(v<min) return (min-v);
-    if(v>max) return (v-max);
-    return 0;
-}
-
-/// Birchfield-Tomasi gray distance between pixels p and q
-int Match::data_penalty_gray(Coord p, Coord q) const {
-    int Ip    = IMREF(imLeft,    p), Iq    = IMREF(imRight,    q);
-    int IpMin = IMREF(imLeftMin, p), IqMin = IMREF(imRightMin, q);
-    int IpMax = IMREF(imLeftMax, p), IqMax = IMREF(imRightMax, q);
-
-    int dp = dist_interval(Ip, IqMin, IqMax);
-    int dq = dist_interval(Iq, IpMin, IpMax);
-    int d = std::min(dp, dq);
-    if(d>CUTOFF) d = CUTOFF;
-    if(params.dataCost==Parameters::L2) d = d*d;
-
-    return d;
-}
-
-/// Birchfield-Tomasi color distance between pixels p and q
-int Match::data_penalty_color(Coord p, Coord q) const {
-    int dSum=0;
-    // Loop over the 3 channels
-    for(int i=0; i<3; i++) {
-        int Ip    = IMREF(imColorLeft,     p).c[i];
-        int Iq    = IMREF(imColorRight,    q).c[i];
-        int IpMin = IMREF(imColorLeftMin,  p).c[i];
-        int IqMin = IMREF(imColorRightMin, q).c[i];
-        int IpMax = IMREF(imColorLeftMax,  p).c[i];
-        int IqMax = IMREF(imColorRightMax, q).c[i];
-
-        int dp = dist_interval(Ip, IqMin, IqMax);
-        int dq = dist_interval(Iq, IpMin, IpMax);
-        int d = std::min(dp, dq);
-        if(d>CUTOFF) d = CUTOFF;
-        if(params.dataCost==Parameters::L2) d = d*d;
-        dSum += d;
-    }
-    return dSum/3;
-}
 
 /************************************************************/
 /******************* Preprocessing for Birchfield-Tomasi ****/
 /************************************************************/
 
-/// Fill ImMin and ImMax from Im (gray version)
-static void SubPixel(GrayImage Im, GrayImage ImMin, GrayImage ImMax) {
-    Coord p;
-    int I, I1, I2, I3, I4, IMin, IMax;
-    int xmax=imGetXSize(ImMin), ymax=imGetYSize(ImMin);
-
-    for (p.y=0; p.y<ymax; p.y++)
-    for (p.x=0; p.x<xmax; p.x++) {
-        I = IMin = IMax = imRef(Im, p.x, p.y);
-        I1 = (p.x>0?      (imRef(Im, p.x-1, p.y) + I) / 2: I);
-        I2 = (p.x+1<xmax? (imRef(Im, p.x+1, p.y) + I) / 2: I);
-        I3 = (p.y>0?      (imRef(Im, p.x, p.y-1) + I) / 2: I);
-        I4 = (p.y+1<ymax? (imRef(Im, p.x, p.y+1) + I) / 2: I);
-
-        if (IMin > I1) IMin = I1;
-        if (IMin > I2) IMin = I2;
-        if (IMin > I3) IMin = I3;
-        if (IMin > I4) IMin = I4;
-        if (IMax < I1) IMax = I1;
-        if (IMax < I2) IMax = I2;
-        if (IMax < I3) IMax = I3;
-        if (IMax < I4) IMax = I4;
-
-        imRef(ImMin, p.x, p.y) = IMin;
-        imRef(ImMax, p.x, p.y) = IMax;
-    }
-}
-
-/// Fill ImMin and ImMax from Im (color version)
-static void SubPixelColor(RGBImage Im, RGBImage ImMin, RGBImage ImMax) {
+/// Fill ImMin and ImMax from Im
+template <class Im>
+static void SubPixel(Im Im0, Im ImMin, Im ImMax) {
+    typedef PixelTraits<Im> P;
     int I, I1, I2, I3, I4, IMin, IMax;
 
     Coord p;
     int xmax=imGetXSize(ImMin), ymax=imGetYSize(ImMin);
     for(p.y=0; p.y<ymax; p.y++)
     for(p.x=0; p.x<xmax; p.x++)
-        for(int i=0; i<3; i++) { // Loop over channels
-            I = IMin = IMax = imRef(Im, p.x, p.y).c[i];
-            I1 = (p.x>0?      (imRef(Im, p.x-1, p.y).c[i] + I) / 2: I);
-            I2 = (p.x+1<xmax? (imRef(Im, p.x+1, p.y).c[i] + I) / 2: I);
-            I3 = (p.y>0?      (imRef(Im, p.x, p.y-1).c[i] + I) / 2: I);
-            I4 = (p.y+1<ymax? (imRef(Im, p.x, p.y+1).c[i] + I) / 2: I);
+        for(int i=0; i<P::channels; i++) { // Loop over channels
+            I = IMin = IMax = P::at(Im0, p, i);
+            I1 = (p.x>0?      (P::at(Im0,Coord(p.x-1,p.y),i) + I) / 2: I);
+            I2 = (p.x+1<xmax? (P::at(Im0,Coord(p.x+1,p.y),i) + I) / 2: I);
+            I3 = (p.y>0?      (P::at(Im0,Coord(p.x,p.y-1),i) + I) / 2: I);
+            I4 = (p.y+1<ymax? (P::at(Im0,Coord(p.x,p.y+1),i) + I) / 2: I);
 
             if (IMin > I1) IMin = I1;
             if (IMin > I2) IMin = I2;
@@ -141,61 +63,138 @@ static void SubPixelColor(RGBImage Im, RGBImage ImMin, RGBImage ImMax) {
             if (IMax < I3) IMax = I3;
             if (IMax < I4) IMax = I4;
 
-            imRef(ImMin, p.x, p.y).c[i] = IMin;
-            imRef(ImMax, p.x, p.y).c[i] = IMax;
+            P::at(ImMin, p, i) = IMin;
+            P::at(ImMax, p, i) = IMax;
         }
 }
 
-/// Preprocessing for faster Birchfield-Tomasi distance computation.
-void Match::InitSubPixel() {
-    if(imLeft && !imLeftMin) {
-        imLeftMin  = (GrayImage) imNew(IMAGE_GRAY, imSizeL);
-        imLeftMax  = (GrayImage) imNew(IMAGE_GRAY, imSizeL);
-        imRightMin = (GrayImage) imNew(IMAGE_GRAY, imSizeR);
-        imRightMax = (GrayImage) imNew(IMAGE_GRAY, imSizeR);
-
-        SubPixel(imLeft,  imLeftMin,  imLeftMax);
-        SubPixel(imRight, imRightMin, imRightMax);
-    }
-    if(imColorLeft && !imColorLeftMin) {
-        imColorLeftMin  = (RGBImage) imNew(IMAGE_RGB, imSizeL);
-        imColorLeftMax  = (RGBImage) imNew(IMAGE_RGB, imSizeL);
-        imColorRightMin = (RGBImage) imNew(IMAGE_RGB, imSizeR);
-        imColorRightMax = (RGBImage) imNew(IMAGE_RGB, imSizeR);
-
-        SubPixelColor(imColorLeft,  imColorLeftMin,  imColorLeftMax);
-        SubPixelColor(imColorRight, imColorRightMin, imColorRightMax);
+/// Fill ImMin and ImMax from Im, any image type
+static void SubPixel(ImageType type,
+                     GeneralImage Im, GeneralImage ImMin, GeneralImage ImMax) {
+    switch(type) {
+    case IMAGE_GRAY:
+        SubPixel((GrayImage)Im,   (GrayImage)ImMin,   (GrayImage)ImMax);   break;
+    case IMAGE_RGB:
+        SubPixel((RGBImage)Im,    (RGBImage)ImMin,    (RGBImage)ImMax);    break;
+    case IMAGE_GRAY16:
+        SubPixel((Gray16Image)Im, (Gray16Image)ImMin, (Gray16Image)ImMax); break;
+    case IMAGE_RGB16:
+        SubPixel((RGB16Image)Im,  (RGB16Image)ImMin,  (RGB16Image)ImMax);  break;
+    default: assert(false);
     }
 }
 
 /************************************************************/
-/****************** smoothness penalty **********************/
+/******************* Edges for smoothness penalty ***********/
 /************************************************************/
 
-/// Smoothness penalty between assignments (p1,p1+disp) and (p2,p2+disp).
-int Match::smoothness_penalty_gray(Coord p1, Coord p2, int disp) const {
-    // |I1(p1)-I1(p2)| and |I2(p1+disp)-I2(p2+disp)|
-    int dl = IMREF(imLeft,  p1     ) - IMREF(imLeft,  p2     );
-    int dr = IMREF(imRight, p1+disp) - IMREF(imRight, p2+disp);
-    if (dl<0) {dl = -dl;} if (dr<0) {dr = -dr;}
-    return (dl<params.edgeThresh && dr<params.edgeThresh)?
-        params.lambda1: params.lambda2;
+/// Fill bitmap \a edges from image \a im, see EDGE_X and EDGE_Y. The edge
+/// threshold \a thresh is given in 8-bit levels.
+template <class Im>
+static void EdgeBitmap(Im im, GrayImage edges, int thresh) {
+    typedef PixelTraits<Im> P;
+    thresh <<= P::bits-8;
+    const int xmax=imGetXSize(edges), ymax=imGetYSize(edges);
+    Coord p;
+    for(p.y=0; p.y<ymax; p.y++) {
+        const bool down = (p.y+1<ymax);
+        for(p.x=0; p.x<xmax; p.x++) {
+            const bool right = (p.x+1<xmax);
+            int dx=0, dy=0; // Max inf norm of differences with neighbors
+            for(int i=0; i<P::channels; i++) {
+                int I = P::at(im, p, i);
+                if(right)
+                    dx = std::max(dx,std::abs(P::at(im,Coord(p.x+1,p.y),i)-I));
+                if(down)
+                    dy = std::max(dy,std::abs(P::at(im,Coord(p.x,p.y+1),i)-I));
+            }
+            IMREF(edges, p) = (unsigned char)
+                ((dx>=thresh? EDGE_X: 0) | (dy>=thresh? EDGE_Y: 0));
+        }
+    }
+}
+
+/// Fill bitmap \a edges from image \a im, any image type
+static void EdgeBitmap(ImageType type, GeneralImage im, GrayImage edges,
+                       int thresh) {
+    switch(type) {
+    case IMAGE_GRAY:   EdgeBitmap((GrayImage)im,   edges, thresh); break;
+    case IMAGE_RGB:    EdgeBitmap((RGBImage)im,    edges, thresh); break;
+    case IMAGE_GRAY16: EdgeBitmap((Gray16Image)im, edges, thresh); break;
+    case IMAGE_RGB16:  EdgeBitmap((RGB16Image)im,  edges, thresh); break;
+    default: assert(false);
+    }
+}
+
+/// Disparity of pixel p refined to subpixel precision, from the data costs at
+/// disparities d-1, d and d+1. The minimum of the parabola (L2) or of the
+/// symmetric V (equiangular, L1) through these costs is at most 1/2 away from
+/// d. The disparity stays d when it is at a bound of the disparity range or
+/// of the right image, or when d is not a strict local minimum of the cost.
+template <class Im, int Norm>
+inline float Match::subpixel_disparity(Coord p, int d, SubPixelFit fit) const {
+    if(d==dispMin || d==dispMax ||
+       !inRect(p+(d-1),imSizeR) || !inRect(p+(d+1),imSizeR))
+        return (float)d;
+    int c0 = data_penalty<Im,Norm>(p,p+d);
+    int cm = data_penalty<Im,Norm>(p,p+(d-1));
+    int cp = data_penalty<Im,Norm>(p,p+(d+1));
+    if(cm<=c0 || cp<=c0)
+        return (float)d;
+    int den = (fit==FIT_PARABOLA)? cm-2*c0+cp: std::max(cm,cp)-c0;
+    if(den==0) // Flat cost
+        return (float)d;
+    return d + (cm-cp)/(2.0f*den);
+}
+
+/// Write in \a out, of the original size of the left image, the disparities of
+/// the region of interest refined by \a fit, see subpixel_disparity.
+void Match::subpixel_disparities(FloatImage out, SubPixelFit fit) const {
+    KERNEL_DISPATCH(subpixel_disparities, (out, fit));
+}
+
+/// Refinement of disparities for an image type and norm, see
+/// subpixel_disparities.
+template <class Im, int Norm>
+void Match::subpixel_disparities(FloatImage out, SubPixelFit fit) const {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for(int y=roiMin.y; y<roiMax.y; y++)
+        for(Coord p(roiMin.x,y); p.x<roiMax.x; p.x++) {
+            int d=disp(p);
+            if(d!=OCCLUDED)
+                IMREF(out,p+origin) =
+                    subpixel_disparity<Im,Norm>(p,d,fit)-dispOffset;
+        }
+}
+
+/// Preprocessing for faster Birchfield-Tomasi distance computation.
+void Match::InitSubPixel() {
+    if(! imLeftMin) {
+        imLeftMin  = (GeneralImage) imNew(imType, imSizeL);
+        imLeftMax  = (GeneralImage) imNew(imType, imSizeL);
+        imRightMin = (GeneralImage) imNew(imType, imSizeR);
+        imRightMax = (GeneralImage) imNew(imType, imSizeR);
+
+        SubPixel(imType, imLeft,  imLeftMin,  imLeftMax);
+        SubPixel(imType, imRight, imRightMin, imRightMax);
+    }
 }
 
-/// Smoothness penalty between assignments (p1,p1+disp) and (p2,p2+disp).
-int Match::smoothness_penalty_color(Coord p1, Coord p2, int disp) const {
-    int d, dMax=0; // Max inf norm in RGB space of (p1,p2) and (p1+disp,p2+disp)
-    for(int i=0; i<3; i++) {
-        d = IMREF(imColorLeft,  p1     ).c[i]-IMREF(imColorLeft,  p2     ).c[i];
-        if(d<0) {d = -d;} if (dMax<d) {dMax = d;}
-        d = IMREF(imColorRight, p1+disp).c[i]-IMREF(imColorRight, p2+disp).c[i];
-        if(d<0) {d = -d;} if (dMax<d) {dMax = d;}
+/// Bitmaps of edges of both images, for the current edge threshold.
+void Match::InitEdges() {
+    if(! imLeftEdge) {
+        imLeftEdge  = (GrayImage) imNew(IMAGE_GRAY, imSizeL);
+        imRightEdge = (GrayImage) imNew(IMAGE_GRAY, imSizeR);
     }
-    return (dMax<params.edgeThresh)? params.lambda1: params.lambda2;
+    EdgeBitmap(imType, imLeft,  imLeftEdge,  params.edgeThresh);
+    EdgeBitmap(imType, imRight, imRightEdge, params.edgeThresh);
 }
 
 /// Set parameters for algorithm
 void Match::SetParameters(Parameters *_params) {
     params = *_params;
     InitSubPixel();
+    InitEdges();
 }
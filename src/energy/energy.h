@@ -41,15 +41,20 @@
 ///
 /// This is just a thin interface around a maxflow core.
 /// See test_energy.cpp for example usage.
-class Energy : Graph<short,short,int>
+///
+/// Index: type of variable and arc indices
+/// Total: type of the total energy
+template <typename Index, typename Total>
+class EnergyT : Graph<short,short,Total,Index>
 {
+    typedef Graph<short,short,Total,Index> Base;
 public:
-    typedef node_id Var;
+    typedef Index Var;
     typedef short Value; ///< Type of a value in a single term
-    typedef int TotalValue; ///< Type of a value of the total energy
+    typedef Total TotalValue; ///< Type of a value of the total energy
 
-    Energy(int hintNbNodes=0, int hintNbArcs=0);
-    ~Energy();
+    EnergyT(Index hintNbNodes=0, Index hintNbArcs=0);
+    ~EnergyT();
 
     Var add_variable(Value E0=0, Value E1=0);
     void add_constant(Value E);
@@ -57,60 +62,93 @@ public:
     void add_term2(Var x, Var y, Value E00, Value E01, Value E10, Value E11);
     void forbid01(Var x, Var y);
 
-    TotalValue minimize();
+    TotalValue minimize(bool reduceFirst=false);
     int get_var(Var x) const;
 
+    /// Counters of maxflow, for benchmarking
+    typedef typename Base::Stats Stats;
+    using Base::get_stats;
+    /// Save graph before minimize, for benchmarking maxflow. The constant
+    /// term is not saved.
+    using Base::save;
+
 private:
     TotalValue Econst; ///< Constant added to the energy
 };
 
+/// Energy with 32-bit indices, compact enough for most images. The total is
+/// 64-bit, as a sum over millions of pixels may overflow 32 bits.
+typedef EnergyT<int,long long> Energy;
+/// Energy with 64-bit indices, for graphs of more than 2^31 arcs
+typedef EnergyT<long long,long long> LargeEnergy;
+
 /// Constructor.
 /// For efficiency, it is advised to give appropriate hint sizes.
-inline Energy::Energy(int hintNbNodes, int hintNbArcs)
-: Graph<short,short,int>(hintNbNodes, hintNbArcs), Econst(0)
+template <typename Index, typename Total>
+inline EnergyT<Index,Total>::EnergyT(Index hintNbNodes, Index hintNbArcs)
+: Base(hintNbNodes, hintNbArcs), Econst(0)
 {}
 
 /// Destructor
-inline Energy::~Energy() {}
+template <typename Index, typename Total>
+inline EnergyT<Index,Total>::~EnergyT() {}
 
 /// Add a new binary variable
-inline Energy::Var Energy::add_variable(Value E0, Value E1) {
-    Energy::Var var = add_node();
+template <typename Index, typename Total>
+inline typename EnergyT<Index,Total>::Var
+EnergyT<Index,Total>::add_variable(Value E0, Value E1) {
+    Var var = Base::add_node();
     add_term1(var, E0, E1);
     return var;
 }
 
 /// Add a constant to the energy function
-inline void Energy::add_constant(Value A) { Econst += A; }
+template <typename Index, typename Total>
+inline void EnergyT<Index,Total>::add_constant(Value A) { Econst += A; }
 
 /// Add a term E(x) of one binary variable to the energy function, where
 /// E(0)=E0, E(1)=E1. E0 and E1 can be arbitrary.
-inline void Energy::add_term1(Var x, Value E0, Value E1) {
-    add_tweights(x, E1, E0);
+template <typename Index, typename Total>
+inline void EnergyT<Index,Total>::add_term1(Var x, Value E0, Value E1) {
+    Base::add_tweights(x, E1, E0);
 }
 
 /// Add a term E(x,y) of two binary variables to the energy function, where
 /// E(0,0)=A, E(0,1)=B, E(1,0)=C, E(1,1)=D.
 /// The term must be regular, i.e. E00+E11 <= E01+E10
-inline void Energy::add_term2(Var x, Var y, Value A, Value B, Value C, Value D){
+template <typename Index, typename Total>
+inline void EnergyT<Index,Total>::add_term2(Var x, Var y,
+                                            Value A, Value B, Value C, Value D){
     // E = A B = B B + A-B 0 +    0    0
     //     C D   D D   A-B 0   B+C-A-D 0
-    add_tweights(x, D, B);
-    add_tweights(y, 0, A-B);
-    add_edge(x, y, 0, B+C-A-D);
+    Base::add_tweights(x, D, B);
+    Base::add_tweights(y, 0, A-B);
+    Base::add_edge(x, y, 0, B+C-A-D);
 }
 
 /// Forbid (x,y)=(0,1) by putting infinite value to the arc from x to y.
-inline void Energy::forbid01(Var x, Var y) {
-    add_edge_infty(x, y);
+template <typename Index, typename Total>
+inline void EnergyT<Index,Total>::forbid01(Var x, Var y) {
+    Base::add_edge_infty(x, y);
 }
 
 /// After construction of the energy function, call this to minimize it.
+/// With \a reduceFirst, variables of known value are fixed before the maxflow,
+/// see Graph::reduce.
 /// Return the minimum of the function
-inline Energy::TotalValue Energy::minimize() { return Econst + maxflow(); }
+template <typename Index, typename Total>
+inline typename EnergyT<Index,Total>::TotalValue
+EnergyT<Index,Total>::minimize(bool reduceFirst) {
+    if(reduceFirst)
+        Base::reduce();
+    return Econst + Base::maxflow();
+}
 
 /// After 'minimize' has been called, determine the value of variable 'x'
 /// in the optimal solution. Can be 0 or 1.
-inline int Energy::get_var(Var x) const { return (int)what_segment(x, SINK); }
+template <typename Index, typename Total>
+inline int EnergyT<Index,Total>::get_var(Var x) const {
+    return (int)Base::what_segment(x, Base::SINK);
+}
 
 #endif
@@ -21,10 +21,12 @@
 
 /// Minimize the following function of 3 binary variables:
 /// E(x, y, z) = x - 2*y + 3*(1-z) - 4*x*y + 5*|y-z|
-int main()
+/// Its minimum is -5, reached only at x=y=z=1. Return whether it is found.
+template <class E>
+bool test_energy(const char* name)
 {
-    Energy::Var x, y, z;
-    Energy e;
+    typename E::Var x, y, z;
+    E e;
 
     x = e.add_variable();
     y = e.add_variable();
@@ -37,12 +39,24 @@ int main()
     e.add_term2(x, y, 0, 0, 0, -4); // add term -4*x*y
     e.add_term2(y, z, 0, 5, 5, 0);  // add term 5*|y-z|
 
-    Energy::TotalValue Emin = e.minimize();
+    typename E::TotalValue Emin = e.minimize();
 
-    std::cout << "Minimum = " << Emin   << std::endl;
+    std::cout << name << ": minimum = " << Emin << std::endl;
     std::cout << "Optimal solution:"    << std::endl;
     std::cout << "x = " << e.get_var(x) << std::endl;
     std::cout << "y = " << e.get_var(y) << std::endl;
     std::cout << "z = " << e.get_var(z) << std::endl;
-    return 0;
+
+    bool ok = (Emin==-5 &&
+               e.get_var(x)==1 && e.get_var(y)==1 && e.get_var(z)==1);
+    if(! ok)
+        std::cerr << name << ": expected minimum -5 at x=y=z=1" << std::endl;
+    return ok;
+}
+
+int main()
+{
+    bool ok = test_energy<Energy>("Energy");
+    ok = test_energy<LargeEnergy>("LargeEnergy") && ok;
+    return ok? 0: 1;
 }
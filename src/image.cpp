@@ -33,22 +33,30 @@
 static const int ONE = 1;
 static const int SWAP_BYTES = (((char *)(&ONE))[0] == 0) ? 1 : 0;
 
-void* imNew(ImageType type, int xsize, int ysize)
+/// Size in bytes of a pixel of given type, 0 if unknown.
+static int imDataSize(ImageType type)
+{
+    switch (type) {
+    case IMAGE_GRAY:   return sizeof(unsigned char);
+    case IMAGE_RGB:    return sizeof(unsigned char[3]);
+    case IMAGE_INT:    return sizeof(int);
+    case IMAGE_FLOAT:  return sizeof(float);
+    case IMAGE_GRAY16: return sizeof(unsigned short);
+    case IMAGE_RGB16:  return sizeof(unsigned short[3]);
+    default: return 0;
+    }
+}
+
+/// Build image header and row pointers around buffer \a data, which is adopted
+/// by the image and released by imFree. It must have been allocated by malloc.
+static void* imWrap(ImageType type, int xsize, int ysize, void* data)
 {
     void *ptr;
     GeneralImage im;
-    int data_size;
+    int data_size = imDataSize(type);
     int y;
 
-    if (xsize<=0 || ysize<=0) return NULL;
-
-    switch (type) {
-    case IMAGE_GRAY:   data_size = sizeof(unsigned char);    break;
-    case IMAGE_RGB:    data_size = sizeof(unsigned char[3]); break;
-    case IMAGE_INT:    data_size = sizeof(int);              break;
-    case IMAGE_FLOAT:  data_size = sizeof(float);            break;
-    default: return NULL;
-    }
+    if (xsize<=0 || ysize<=0 || data_size==0 || !data) return NULL;
 
     ptr = malloc(sizeof(ImageHeader) + ysize*sizeof(void*));
     if (!ptr) return NULL;
@@ -59,13 +67,45 @@ void* imNew(ImageType type, int xsize, int ysize)
     imHeader(im)->xsize     = xsize;
     imHeader(im)->ysize     = ysize;
 
-    im->data = (void *) malloc(xsize*ysize*data_size);
+    im->data = data;
     for (y=1; y<ysize; y++)
-        (im+y)->data = ((char*)(im->data)) + xsize*y*data_size;
+        (im+y)->data = ((char*)(im->data)) + (size_t)xsize*y*data_size;
+
+    return im;
+}
+
+void* imNew(ImageType type, int xsize, int ysize)
+{
+    if (xsize<=0 || ysize<=0 || imDataSize(type)==0) return NULL;
 
+    void* data = malloc((size_t)xsize*ysize*imDataSize(type));
+    void* im = imWrap(type, xsize, ysize, data);
+    if (!im) free(data);
     return im;
 }
 
+/// Image sharing the pixels of the rectangle of \a im with top-left corner
+/// (x,y) and given size, which must be inside \a im. The rows of a view are
+/// not contiguous. It must be freed by imFreeView, before \a im is freed.
+void* imView(void *im, int x, int y, int xsize, int ysize)
+{
+    int data_size = imHeader(im)->data_size;
+    if (x<0 || y<0 || xsize<=0 || ysize<=0 ||
+        x+xsize>imHeader(im)->xsize || y+ysize>imHeader(im)->ysize)
+        return NULL;
+
+    void* ptr = malloc(sizeof(ImageHeader) + ysize*sizeof(void*));
+    if (!ptr) return NULL;
+    GeneralImage view = (GeneralImage) ((char*)ptr + sizeof(ImageHeader));
+
+    *imHeader(view) = *imHeader(im);
+    imHeader(view)->xsize = xsize;
+    imHeader(view)->ysize = ysize;
+    for (int j=0; j<ysize; j++)
+        (view+j)->data = (char*)(((GeneralImage)im+y+j)->data) + x*data_size;
+    return view;
+}
+
 void SwapBytes(GeneralImage im)
 {
     if (SWAP_BYTES) {
@@ -92,25 +132,44 @@ void SwapBytes(GeneralImage im)
     }
 }
 
-/// Load image
-void* imLoad(ImageType type, const char *filename)
+/// Is the interleaved RGB buffer gray? If so, keep only its first channel.
+template <typename T>
+static bool compactGray(T*& data, size_t size)
+{
+    for(size_t i=0; i<size; i++)
+        if(data[3*i]!=data[3*i+1] || data[3*i]!=data[3*i+2])
+            return false;
+    for(size_t i=0; i<size; i++)
+        data[i] = data[3*i];
+    T* gray = (T*) realloc(data, size*sizeof(T));
+    if(gray) data = gray;
+    return true;
+}
+
+/// Image type with \a nc channels (1 or 3) and \a nb bytes per channel.
+static ImageType imType(size_t nc, size_t nb)
+{
+    if(nb==2)
+        return (nc==1)? IMAGE_GRAY16: IMAGE_RGB16;
+    return (nc==1)? IMAGE_GRAY: IMAGE_RGB;
+}
+
+/// Load image with \a nc channels, 1 (gray), 3 (RGB) or 0 (gray if possible),
+/// and \a nb bytes per channel, 1 or 0 (2 if the file has more than 8 bits).
+///
+/// The pixels are decoded in the final interleaved layout, so that the buffer
+/// is adopted by the image without copy. A color PNG file loaded as gray is
+/// converted to luminance. The values of a 16-bit PNM file are scaled to 65535.
+static void* imLoadChannels(size_t nc, size_t nb, const char *filename)
 {
-    assert(type==IMAGE_GRAY || type==IMAGE_RGB);
     unsigned char* data=0;
     size_t xsize, ysize;
-    int stepColor=1; // Distance between color planes of same pixel
-    int stepPixel=3; // Distance between consecutive pixels
 
     const char* ext = strrchr(filename,'.');
     if(ext && (strcmp(ext,".png")==0)) {
 #ifdef HAS_PNG
-        if(type == IMAGE_GRAY)
-            data = io_png_read_u8_gray(filename, &xsize, &ysize);
-        if(type == IMAGE_RGB) {
-            data = io_png_read_u8_rgb(filename, &xsize, &ysize);
-            stepColor=xsize*ysize; // Planar color format
-            stepPixel=1;
-        }
+        data = (unsigned char*)
+            io_png_read_interleaved(filename, &xsize, &ysize, &nc, &nb);
         if(! data) return 0;
 #else
         std::cerr << "Unable to read file " << filename << " as PNG since the "
@@ -124,7 +183,7 @@ void* imLoad(ImageType type, const char *filename)
         if(! file)
             return 0;
         char c;
-        bool text=false;
+        bool text=false, detectGray=(nc==0);
         while(file >> c)
             if(c=='#') { // Skip comments
                 std::string s;
@@ -135,17 +194,19 @@ void* imLoad(ImageType type, const char *filename)
                 file >> c;
                 text = (c=='2'||c=='3');
                 c -= 3;
-                if(c=='2' && type==IMAGE_GRAY) break;
-                if(c=='3' && type==IMAGE_RGB) break;
+                if(c=='2' && nc!=3) { nc=1; break; }
+                if(c=='3' && nc!=1) { nc=3; break; }
                 return 0;
             }
             else return 0;
         int max=0;
         if(! (file >> xsize >> ysize >> max)) return 0;
-        assert(max<256);
-        int size = ((type==IMAGE_GRAY? 1: 3) *xsize*ysize);
-        data = (unsigned char*) malloc(size);
+        if(max<=0 || max>65535 || (max>255 && nb==1)) return 0;
+        nb = (max>255)? 2: 1;
+        int size = (nc*xsize*ysize);
+        data = (unsigned char*) malloc(size*nb);
         if(! data) return 0;
+        unsigned short* data16 = (unsigned short*)data;
         if(text) { // Read ASCII
             int read=0;
             std::string str;
@@ -155,39 +216,121 @@ void* imLoad(ImageType type, const char *filename)
                     std::getline(file,s);
                     continue;
                 }
-                int nb;
+                int v;
                 if(read==size ||
-                   !(std::istringstream(str)>>nb)) {
+                   !(std::istringstream(str)>>v)) {
                     free(data); return 0;
                 }
-                data[read++] = static_cast<unsigned char>(nb);
+                if(max>255)
+                    data16[read++] = static_cast<unsigned short>(v);
+                else
+                    data[read++] = static_cast<unsigned char>(v);
             }
         } else { // Read binary
             std::string s;
             std::getline(file,s);
-            if(! file.read((char*)(data), size)) {
+            if(! file.read((char*)(data), size*nb)) {
                 free(data); return 0;
             }
+            if(max>255) // Big-endian to native
+                for(int i=0; i<size; i++) {
+                    const unsigned char* b = data+2*i;
+                    data16[i] = (unsigned short)((b[0]<<8) | b[1]);
+                }
         }
-    }
-
-    GeneralImage im = (GeneralImage) imNew(type, xsize, ysize);
-    const size_t size = xsize*ysize;
-    if(type == IMAGE_GRAY)
-        for(size_t i=0; i<size; i++)
-            imRef((GrayImage)im,i,0) = data[i];
-    if(type == IMAGE_RGB) {
-        const size_t r=0*stepColor, g=1*stepColor, b=2*stepColor;
-        for(size_t i=0, j=0; i<size; i++, j+=stepPixel) {
-            imRef((RGBImage)im,i,0).c[0] = data[j+r];
-            imRef((RGBImage)im,i,0).c[1] = data[j+g];
-            imRef((RGBImage)im,i,0).c[2] = data[j+b];
+        if(max>255 && max<65535)
+            for(int i=0; i<size; i++)
+                data16[i] = (unsigned short)
+                    ((data16[i]*65535ul+max/2)/max);
+        if(detectGray && nc==3) {
+            bool gray = (nb==1? compactGray(data,   xsize*ysize):
+                                compactGray(data16, xsize*ysize));
+            if(nb==2) data = (unsigned char*)data16; // possibly reallocated
+            if(gray) nc = 1;
         }
     }
-    free(data);
+
+    void* im = imWrap(imType(nc,nb), (int)xsize, (int)ysize, data);
+    if(! im) free(data);
     return im;
 }
 
+/// Load image
+void* imLoad(ImageType type, const char *filename)
+{
+    assert(type==IMAGE_GRAY || type==IMAGE_RGB);
+    return imLoadChannels(type==IMAGE_GRAY? 1: 3, 1, filename);
+}
+
+/// Load image as gray if all its pixels are gray, as RGB otherwise, with 16
+/// bits per channel if the file has more than 8 bits, 8 bits otherwise.
+///
+/// The test is done while decoding. Use imGetType to know the result.
+void* imLoadGrayOrRGB(const char *filename)
+{
+    return imLoadChannels(0, 0, filename);
+}
+
+/// Copy \a in to \a out of same size, replicating the gray channel to color
+/// and scaling 8-bit values to 16 bits if needed.
+template <class In, class Out>
+static void copy_convert(In in, Out out) {
+    typedef PixelTraits<In>  I;
+    typedef PixelTraits<Out> O;
+    const int scale = ((int)O::bits>(int)I::bits)? 257: 1; // 255*257=65535
+    const Coord size(imGetXSize(in), imGetYSize(in));
+    RectIterator end=rectEnd(size);
+    for(RectIterator p=rectBegin(size); p!=end; ++p)
+        for(int i=0; i<O::channels; i++)
+            O::at(out,*p,i) = (typename O::Channel)
+                (scale*I::at(in,*p,i%I::channels));
+}
+
+/// Return new image of given type, copy of \a in.
+template <class In>
+static GeneralImage convert_to(In in, ImageType type) {
+    void* out = imNew(type, imGetXSize(in), imGetYSize(in));
+    switch(type) {
+    case IMAGE_GRAY:   copy_convert(in, (GrayImage)  out); break;
+    case IMAGE_RGB:    copy_convert(in, (RGBImage)   out); break;
+    case IMAGE_GRAY16: copy_convert(in, (Gray16Image)out); break;
+    case IMAGE_RGB16:  copy_convert(in, (RGB16Image) out); break;
+    default: assert(false);
+    }
+    return (GeneralImage)out;
+}
+
+/// Convert image to given type, which should have at least as many channels
+/// and bits. The image is unchanged if it already has this type.
+static void convert(GeneralImage& im, ImageType type) {
+    GeneralImage out=im;
+    switch(imGetType(im)) {
+    case IMAGE_GRAY:   out = convert_to((GrayImage)  im, type); break;
+    case IMAGE_RGB:    out = convert_to((RGBImage)   im, type); break;
+    case IMAGE_GRAY16: out = convert_to((Gray16Image)im, type); break;
+    case IMAGE_RGB16:  out = convert_to((RGB16Image) im, type); break;
+    default: assert(false);
+    }
+    imFree(im);
+    im = out;
+}
+
+/// Give the same type to both images: color if one is color, 16 bits if one
+/// has 16 bits.
+void imConvertPair(GeneralImage& im1, GeneralImage& im2) {
+    ImageType t1=imGetType(im1), t2=imGetType(im2);
+    if(t1 == t2)
+        return;
+    bool color = (t1==IMAGE_RGB   || t1==IMAGE_RGB16 ||
+                  t2==IMAGE_RGB   || t2==IMAGE_RGB16);
+    bool deep  = (t1==IMAGE_GRAY16|| t1==IMAGE_RGB16 ||
+                  t2==IMAGE_GRAY16|| t2==IMAGE_RGB16);
+    ImageType type = deep? (color? IMAGE_RGB16: IMAGE_GRAY16):
+                           (color? IMAGE_RGB:   IMAGE_GRAY);
+    if(t1 != type) convert(im1, type);
+    if(t2 != type) convert(im2, type);
+}
+
 int imSave(void *im, const char *filename)
 {
     int i;
@@ -210,26 +353,13 @@ int imSave(void *im, const char *filename)
 
     if(ext && strcmp(ext,".png")==0) {
 #ifdef HAS_PNG
-        if(type==IMAGE_GRAY)
-            return io_png_write_u8 (filename, ((GrayImage)im)->data,
-                                    xsize, ysize, 1);
         if(type==IMAGE_FLOAT)
             return io_png_write_f32(filename, ((FloatImage)im)->data,
                                     xsize, ysize, 1);
-        assert(type==IMAGE_RGB);
-        const size_t size = xsize*ysize;
-        unsigned char* data = new unsigned char[3*size];
-        unsigned char *r=data+0*size;
-        unsigned char *g=data+1*size;
-        unsigned char *b=data+2*size;
-        for(size_t i=0; i<size; i++) {
-            *r++ = imRef((RGBImage)im,i,0).c[0];
-            *g++ = imRef((RGBImage)im,i,0).c[1];
-            *b++ = imRef((RGBImage)im,i,0).c[2];
-        }
-        int res = io_png_write_u8(filename, data, xsize, ysize, 3);
-        delete [] data;
-        return res;
+        assert(type==IMAGE_GRAY || type==IMAGE_RGB);
+        return io_png_write_u8_interleaved(filename,
+                                           (unsigned char*)((GeneralImage)im)->data,
+                                           xsize, ysize, data_size);
 #else
         std::cerr << "Unable to save file " << filename << " as PNG since the "
                   << "program was built without PNG support. Trying PGM..."
@@ -58,7 +58,9 @@ typedef enum
     IMAGE_GRAY,
     IMAGE_RGB,
     IMAGE_INT,
-    IMAGE_FLOAT
+    IMAGE_FLOAT,
+    IMAGE_GRAY16,
+    IMAGE_RGB16
 } ImageType;
 
 typedef struct ImageHeader_st
@@ -74,19 +76,29 @@ typedef struct GrayImage_t  {unsigned char                *data;} *GrayImage;
 typedef struct RGBImage_t   {struct {unsigned char c[3];} *data;} *RGBImage;
 typedef struct IntImage_t   {int                          *data;} *IntImage;
 typedef struct FloatImage_t {float                        *data;} *FloatImage;
+typedef struct Gray16Image_t{unsigned short               *data;} *Gray16Image;
+typedef struct RGB16Image_t {struct {unsigned short c[3];}*data;} *RGB16Image;
 
 #define imHeader(im) ((ImageHeader*) ( ((char*)(im)) - sizeof(ImageHeader) ))
 
 #define imRef(im, x, y) ( ((im)+(y))->data[x] )
 #define imGetXSize(im) (imHeader(im)->xsize)
 #define imGetYSize(im) (imHeader(im)->ysize)
+#define imGetType(im) (imHeader(im)->type)
 
 void * imNew(ImageType type, int xsize, int ysize);
 inline void imFree(void *im) {
     if(im) { free(GeneralImage(im)->data); free(imHeader(im)); }
 }
+void * imView(void *im, int x, int y, int xsize, int ysize);
+/// Free view created by imView, not its pixels
+inline void imFreeView(void *im) {
+    if(im) free(imHeader(im));
+}
 void * imLoad(ImageType type, const char *filename);
+void * imLoadGrayOrRGB(const char *filename);
 int imSave(void *im, const char *filename);
+void imConvertPair(GeneralImage& im1, GeneralImage& im2);
 
 /// Pixel coordinates with basic operations.
 struct Coord
@@ -111,6 +123,30 @@ inline void * imNew(ImageType type, Coord size) {
     return imNew(type, size.x, size.y);
 }
 
+/// Traits of gray and color images, 8 or 16 bits per channel, for templates:
+/// number of channels, bits per channel and access to channel i of pixel p.
+template <class Im> struct PixelTraits;
+template <> struct PixelTraits<GrayImage> {
+    enum { channels=1, bits=8 };
+    typedef unsigned char Channel;
+    static Channel& at(GrayImage im, Coord p, int) { return IMREF(im,p); }
+};
+template <> struct PixelTraits<RGBImage> {
+    enum { channels=3, bits=8 };
+    typedef unsigned char Channel;
+    static Channel& at(RGBImage im, Coord p, int i) { return IMREF(im,p).c[i]; }
+};
+template <> struct PixelTraits<Gray16Image> {
+    enum { channels=1, bits=16 };
+    typedef unsigned short Channel;
+    static Channel& at(Gray16Image im, Coord p, int) { return IMREF(im,p); }
+};
+template <> struct PixelTraits<RGB16Image> {
+    enum { channels=3, bits=16 };
+    typedef unsigned short Channel;
+    static Channel& at(RGB16Image im,Coord p,int i) { return IMREF(im,p).c[i]; }
+};
+
 /// Is p inside rectangle r?
 inline bool inRect(Coord p, Coord r) {
     return (Coord(0,0)<=p && p<r);
@@ -137,4 +173,42 @@ inline RectIterator rectEnd(Coord rect) {
     return it;
 }
 
+/// Iterator over rows [y0,y1) of width w, tile after tile of tw columns, each
+/// tile in raster order. With tw>=w, this is the raster order.
+class TileIterator {
+    Coord p; ///< Current point
+    int x0, x1; ///< Columns of current tile
+    int y0, y1; ///< Rows of tiles
+    int w, tw; ///< Width of rows and of tiles
+public:
+    TileIterator(int width, int row0, int row1, int tileWidth)
+    : p(0,row0), x0(0), x1(tileWidth<width? tileWidth: width),
+      y0(row0), y1(row1), w(width), tw(tileWidth)
+    { if(y0>=y1) p.x = w; } // Empty
+    const Coord& operator*() const { return p; }
+    bool operator!=(const TileIterator& it) const { return (p!=it.p); }
+    TileIterator& operator++() {
+        if(++p.x==x1) {
+            p.x = x0;
+            if(++p.y==y1) { // Next tile
+                p.y = y0;
+                p.x = x0 = x1;
+                x1 = (x1+tw<w)? x1+tw: w;
+            }
+        }
+        return *this;
+    }
+
+    friend TileIterator tileEnd(int w, int y0, int y1, int tw);
+};
+
+inline TileIterator tileBegin(int w, int y0, int y1, int tw) {
+    return TileIterator(w, y0, y1, tw);
+}
+inline TileIterator tileEnd(int w, int y0, int y1, int tw) {
+    TileIterator it(w, y0, y1, tw);
+    it.p.x = w;
+    return it;
+}
+
 #endif
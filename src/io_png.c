@@ -19,7 +19,9 @@
  *
  * This is a front-end to libpng, with routines to:
  * @li read a PNG file as a de-interlaced 8bit integer or float array
+ * @li read a PNG file as an interleaved 8 or 16bit integer array, row by row
  * @li write a 8bit integer or float array to a PNG file
+ * @li write an interleaved 8bit integer array to a PNG file, row by row
  *
  * Multi-channel images are handled: gray, gray+alpha, rgb and
  * rgb+alpha, as well as on-the-fly color model conversion.
@@ -410,6 +412,266 @@ unsigned char *io_png_read_u8_gray(const char *fname,
     }
 }
 
+/**
+ * @brief internal function checking if an interleaved RGB row is gray
+ *
+ * @param row RGB RGB RGB... samples
+ * @param nx number of pixels
+ * @param nb number of bytes per sample
+ * @return 1 if all pixels have equal channels, 0 otherwise
+ */
+static int _io_png_row_is_gray(const unsigned char *row, size_t nx,
+                               size_t nb)
+{
+    size_t i;
+    for (i = 0; i < nx; i++, row += 3 * nb)
+        if (0 != memcmp(row, row + nb, nb)
+            || 0 != memcmp(row, row + 2 * nb, nb))
+            return 0;
+    return 1;
+}
+
+/**
+ * @brief internal function converting interleaved RGB pixels to gray,
+ * in place
+ *
+ * Same RGB->gray conversion as io_png_read_u8_gray(), so that a gray
+ * pixel (equal channels) keeps its value.
+ *
+ * @param data interleaved samples
+ * @param size number of pixels
+ * @param nb number of bytes per sample
+ */
+static void _io_png_luminance(unsigned char *data, size_t size, size_t nb)
+{
+    size_t i;
+    unsigned short *data16 = (unsigned short *) data;
+    for (i = 0; i < size; i++)
+        /* (1 << 14) is added for rounding instead of truncation */
+        if (1 == nb)
+            data[i] = (unsigned char)
+                ((6968ul * data[3 * i] + 23434ul * data[3 * i + 1]
+                  + 2366ul * data[3 * i + 2] + (1 << 14)) >> 15);
+        else
+            data16[i] = (unsigned short)
+                ((6968ul * data16[3 * i] + 23434ul * data16[3 * i + 1]
+                  + 2366ul * data16[3 * i + 2] + (1 << 14)) >> 15);
+}
+
+/**
+ * @brief read a PNG file into an interleaved integer array
+ *
+ * Contrary to io_png_read_u8(), the channels are interleaved
+ * (RGB RGB RGB...) and libpng decodes each row directly into the
+ * returned array, so that no full image temporary is needed. 1, 2 and
+ * 4bit samples are expanded to bytes, palette is converted to RGB and
+ * alpha is stripped. If gray output is requested from a color image,
+ * it is converted to gray row by row, as in io_png_read_u8_gray().
+ *
+ * If *ncp is 0, the output is gray if the image is gray (gray color
+ * type, or color type with equal channels in all pixels) and RGB
+ * otherwise. The check is done row by row during decoding: rows are
+ * stored as gray until the first color row, at which point the array
+ * is expanded to RGB.
+ *
+ * If *nbp is 1, 16bit images are downscaled to 8bit. If it is 2, 8bit
+ * images are upscaled to 16bit and samples are in native byte order.
+ * If it is 0, the depth of the file is kept (1 for 8bit or less).
+ *
+ * @param fname PNG file name, "-" means stdin
+ * @param nxp, nyp pointers to variables to be filled with the number of
+ *        columns and lines of the image
+ * @param ncp pointer to the number of channels of the output, 1 (gray),
+ *        3 (RGB) or 0 (gray or RGB, whichever fits), filled with the
+ *        actual number of channels
+ * @param nbp pointer to the number of bytes per sample of the output,
+ *        1, 2 or 0 (as in the file), filled with the actual value
+ * @return pointer to an allocated array of nx*ny*nc samples,
+ *         or NULL if an error happens
+ */
+void *io_png_read_interleaved(const char *fname,
+                              size_t * nxp, size_t * nyp,
+                              size_t * ncp, size_t * nbp)
+{
+    png_byte png_sig[PNG_SIG_LEN];
+    png_structp png_ptr;
+    png_infop info_ptr;
+    size_t nx, ny, ncf, nb, rowsize;
+    size_t j, k;
+    int npass, pass;
+    /* volatile: because of setjmp/longjmp */
+    FILE *volatile fp = NULL;
+    unsigned char *volatile data = NULL;
+    unsigned char *volatile row = NULL;
+    volatile size_t nc;
+    unsigned char *tmp;
+    const unsigned short one = 1;
+    /* local error structure */
+    _io_png_err_t err;
+
+    /* parameters check */
+    if (NULL == fname || NULL == nxp || NULL == nyp
+        || NULL == ncp || NULL == nbp)
+        return NULL;
+    nc = *ncp;
+    if (0 != nc && 1 != nc && 3 != nc)
+        return NULL;
+    if (0 != *nbp && 1 != *nbp && 2 != *nbp)
+        return NULL;
+
+    /* open the PNG input file */
+    if (0 == strcmp(fname, "-"))
+        fp = stdin;
+    else if (NULL == (fp = fopen(fname, "rb")))
+        return NULL;
+
+    /* read in some of the signature bytes and check this signature */
+    if ((PNG_SIG_LEN != fread(png_sig, 1, PNG_SIG_LEN, fp))
+        || 0 != png_sig_cmp(png_sig, (png_size_t) 0, PNG_SIG_LEN))
+        return _io_png_read_abort(fp, NULL, NULL);
+
+    /*
+     * create and initialize the png_struct
+     * with local error handling
+     */
+    if (NULL == (png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING,
+                                                  &err, &_io_png_err_hdl,
+                                                  NULL)))
+        return _io_png_read_abort(fp, NULL, NULL);
+
+    /* allocate/initialize the memory for image information */
+    if (NULL == (info_ptr = png_create_info_struct(png_ptr)))
+        return _io_png_read_abort(fp, &png_ptr, NULL);
+
+    /* handle read errors */
+    if (setjmp(err.jmpbuf)) {
+        /* if we get here, we had a problem reading from the file */
+        free(data);
+        free(row);
+        return _io_png_read_abort(fp, &png_ptr, &info_ptr);
+    }
+
+    /* set up the input control using standard C streams */
+    png_init_io(png_ptr, fp);
+
+    /* let libpng know that some bytes have been read */
+    png_set_sig_bytes(png_ptr, PNG_SIG_LEN);
+    png_read_info(png_ptr, info_ptr);
+
+    /* bytes per sample */
+    nb = *nbp;
+    if (0 == nb)
+        nb = (16 == png_get_bit_depth(png_ptr, info_ptr)) ? 2 : 1;
+
+    /* same transforms as io_png_read_raw(), to get gray or RGB */
+    if (1 == nb)
+        png_set_strip_16(png_ptr);
+    png_set_packing(png_ptr);
+    png_set_strip_alpha(png_ptr);
+    png_set_palette_to_rgb(png_ptr);
+    if (2 == nb) {
+        png_set_expand_16(png_ptr);
+        if (1 == *(const unsigned char *) &one)
+            /* little-endian host, PNG samples are big-endian */
+            png_set_swap(png_ptr);
+    }
+    if (3 == nc
+        && 0 == (png_get_color_type(png_ptr, info_ptr) & PNG_COLOR_MASK_COLOR))
+        png_set_gray_to_rgb(png_ptr);
+    npass = png_set_interlace_handling(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
+
+    /* get image informations, after transforms */
+    nx = (size_t) png_get_image_width(png_ptr, info_ptr);
+    ny = (size_t) png_get_image_height(png_ptr, info_ptr);
+    ncf = (size_t) png_get_channels(png_ptr, info_ptr);
+    if (0 == nc && 1 == ncf)
+        nc = 1; /* gray color type */
+    rowsize = nx * ncf * nb;
+
+    if (ncf == nc || 1 < npass) {
+        /*
+         * decode in place; an interlaced color image read as gray needs
+         * its full rows for all passes, the gray check and the gray
+         * conversion are done afterwards
+         */
+        if (NULL == (data = (unsigned char *) malloc(ny * rowsize)))
+            return _io_png_read_abort(fp, &png_ptr, &info_ptr);
+        for (pass = 0; pass < npass; pass++)
+            for (j = 0; j < ny; j++)
+                png_read_row(png_ptr, data + rowsize * j, NULL);
+        if (0 == nc)
+            nc = _io_png_row_is_gray(data, nx * ny, nb) ? 1 : 3;
+        if (ncf != nc) {
+            _io_png_luminance(data, nx * ny, nb);
+            data = (unsigned char *) realloc(data, nx * ny * nc * nb);
+        }
+    } else {
+        /*
+         * color image read as gray: convert to gray, one row at a time;
+         * in automatic mode, switch to RGB at the first color row
+         */
+        if (NULL == (data = (unsigned char *) malloc(nx * ny * nb))
+            || NULL == (row = (unsigned char *) malloc(rowsize))) {
+            free(data);
+            return _io_png_read_abort(fp, &png_ptr, &info_ptr);
+        }
+        for (j = 0; j < ny; j++) {
+            png_read_row(png_ptr, row, NULL);
+            if (0 == nc && !_io_png_row_is_gray(row, nx, nb)) {
+                /* expand rows 0..j-1 to RGB, last pixel first */
+                if (NULL == (tmp = (unsigned char *)
+                             realloc(data, ny * rowsize))) {
+                    free(data);
+                    free(row);
+                    return _io_png_read_abort(fp, &png_ptr, &info_ptr);
+                }
+                data = tmp;
+                for (k = nx * j; k-- > 0;) {
+                    memmove(data + 3 * k * nb, data + k * nb, nb);
+                    memcpy(data + (3 * k + 1) * nb, data + 3 * k * nb, nb);
+                    memcpy(data + (3 * k + 2) * nb, data + 3 * k * nb, nb);
+                }
+                memcpy(data + rowsize * j, row, rowsize);
+                for (j++; j < ny; j++)
+                    png_read_row(png_ptr, data + rowsize * j, NULL);
+                nc = ncf;
+                break;
+            }
+            _io_png_luminance(row, nx, nb);
+            memcpy(data + nx * nb * j, row, nx * nb);
+        }
+        if (0 == nc)
+            nc = 1;
+        free(row);
+        row = NULL;
+    }
+    png_read_end(png_ptr, NULL);
+
+    /* clean up and free any memory allocated, close the file */
+    (void) _io_png_read_abort(fp, &png_ptr, &info_ptr);
+
+    *nxp = nx;
+    *nyp = ny;
+    *ncp = nc;
+    *nbp = nb;
+    return data;
+}
+
+/**
+ * @brief read a PNG file into an interleaved 8bit integer array
+ *
+ * See io_png_read_interleaved() for details.
+ */
+unsigned char *io_png_read_u8_interleaved(const char *fname,
+                                          size_t * nxp, size_t * nyp,
+                                          size_t * ncp)
+{
+    size_t nb = 1;
+    return (unsigned char *) io_png_read_interleaved(fname, nxp, nyp,
+                                                     ncp, &nb);
+}
+
 /**
  * @brief read a PNG file into a 32bit float array
  *
@@ -714,6 +976,96 @@ int io_png_write_u8(const char *fname, const unsigned char *data,
                             IO_PNG_U8);
 }
 
+/**
+ * @brief write an interleaved 8bit array into a PNG file
+ *
+ * Contrary to io_png_write_u8(), the channels are interleaved
+ * (RGB RGB RGB...) and the rows of data are passed directly to
+ * libpng, without any temporary copy. The file is not interlaced.
+ *
+ * @param fname PNG file name, "-" means stdout
+ * @param data interleaved image byte array
+ * @param nx, ny, nc number of columns, lines and channels of the image
+ * @return 0 if everything OK, -1 if an error occured
+ */
+int io_png_write_u8_interleaved(const char *fname, const unsigned char *data,
+                                size_t nx, size_t ny, size_t nc)
+{
+    png_structp png_ptr;
+    png_infop info_ptr;
+    /* volatile: because of setjmp/longjmp */
+    FILE *volatile fp;
+    int color_type;
+    size_t j;
+    /* error structure */
+    _io_png_err_t err;
+
+    /* parameters check */
+    if (0 >= nx || 0 >= ny)
+        return -1;
+    if (NULL == fname || NULL == data)
+        return -1;
+    switch (nc) {
+    case 1:
+        color_type = PNG_COLOR_TYPE_GRAY;
+        break;
+    case 2:
+        color_type = PNG_COLOR_TYPE_GRAY_ALPHA;
+        break;
+    case 3:
+        color_type = PNG_COLOR_TYPE_RGB;
+        break;
+    case 4:
+        color_type = PNG_COLOR_TYPE_RGB_ALPHA;
+        break;
+    default:
+        return -1;
+    }
+
+    /* open the PNG output file */
+    if (0 == strcmp(fname, "-"))
+        fp = stdout;
+    else if (NULL == (fp = fopen(fname, "wb")))
+        return -1;
+
+    /*
+     * create and initialize the png_struct
+     * with local error handling
+     */
+    if (NULL == (png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+                                                   &err, &_io_png_err_hdl,
+                                                   NULL)))
+        return _io_png_write_abort(fp, NULL, NULL, NULL, NULL);
+
+    /* allocate/initialize the memory for image information */
+    if (NULL == (info_ptr = png_create_info_struct(png_ptr)))
+        return _io_png_write_abort(fp, NULL, NULL, &png_ptr, NULL);
+
+    /* handle write errors */
+    if (0 != setjmp(err.jmpbuf))
+        /* if we get here, we had a problem writing to the file */
+        return _io_png_write_abort(fp, NULL, NULL, &png_ptr, &info_ptr);
+
+    /* set up the input control using standard C streams */
+    png_init_io(png_ptr, fp);
+
+    /* set image header */
+    png_set_IHDR(png_ptr, info_ptr, (png_uint_32) nx, (png_uint_32) ny,
+                 8, color_type, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    png_write_info(png_ptr, info_ptr);
+
+    /* write out the image row by row and end it */
+    for (j = 0; j < ny; j++)
+        png_write_row(png_ptr, (png_const_bytep) (data + nc * nx * j));
+    png_write_end(png_ptr, info_ptr);
+
+    /* clean up and free any memory allocated, close the file */
+    (void) _io_png_write_abort(fp, NULL, NULL, &png_ptr, &info_ptr);
+
+    return 0;
+}
+
 /**
  * @brief write a float array into a PNG file
  *
@@ -14,10 +14,13 @@ char *io_png_info(void);
 unsigned char *io_png_read_u8(const char *fname, size_t *nxp, size_t *nyp, size_t *ncp);
 unsigned char *io_png_read_u8_rgb(const char *fname, size_t *nxp, size_t *nyp);
 unsigned char *io_png_read_u8_gray(const char *fname, size_t *nxp, size_t *nyp);
+void *io_png_read_interleaved(const char *fname, size_t *nxp, size_t *nyp, size_t *ncp, size_t *nbp);
+unsigned char *io_png_read_u8_interleaved(const char *fname, size_t *nxp, size_t *nyp, size_t *ncp);
 float *io_png_read_f32(const char *fname, size_t *nxp, size_t *nyp, size_t *ncp);
 float *io_png_read_f32_rgb(const char *fname, size_t *nxp, size_t *nyp);
 float *io_png_read_f32_gray(const char *fname, size_t *nxp, size_t *nyp);
 int io_png_write_u8(const char *fname, const unsigned char *data, size_t nx, size_t ny, size_t nc);
+int io_png_write_u8_interleaved(const char *fname, const unsigned char *data, size_t nx, size_t ny, size_t nc);
 int io_png_write_f32(const char *fname, const float *data, size_t nx, size_t ny, size_t nc);
 
 void rgb_to_gray(const float *ptr_r, const float *ptr_g, const float *ptr_b,
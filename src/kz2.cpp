@@ -16,97 +16,196 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include "match.h"
+#include "penalty.h"
 #include "energy.h"
+#include "timer.h"
 #include <iostream>
 #include <iomanip>
 #include <sstream>
 #include <string>
+#include <algorithm>
+#include <vector>
 #include <cassert>
+#include <climits>
+
+/// Half-size of window of block matching proposals for range moves
+static const int RANGE_RADIUS=4;
 
 /// (half of) the neighborhood system.
 /// The full neighborhood system is edges in NEIGHBORS plus reversed edges.
 const struct Coord NEIGHBORS[] = { Coord(-1,0), Coord(0,1) };
 #define NEIGHBOR_NUM (sizeof(NEIGHBORS) / sizeof(Coord))
 
+/// Size of tiles ordering graph nodes with ORDER_TILES: about 2x8x32 nodes
+/// of 32 bytes fit in a 16 KiB cache.
+static const Coord NODE_TILE(32,8);
+
+/// Size of tiles ordering graph nodes: one band of full rows per row for
+/// ORDER_RASTER.
+Coord Match::node_tile() const {
+    return (nodeOrder==ORDER_TILES)? NODE_TILE: Coord(imSizeL.x,1);
+}
+
 /// Compute the data+occlusion penalty (D(a)-K)
-int Match::data_occlusion_penalty(Coord p, Coord q) const {
-    int D = (imLeft? data_penalty_gray(p,q): data_penalty_color(p,q));
-    return params.denominator*D - params.K;
+template <class Im, int Norm>
+inline int Match::data_occlusion_penalty(Coord p, Coord q) const {
+    int D = data_penalty<Im,Norm>(p,q);
+    return (params.denominator>>costShift)*D - params.K;
 }
 
-/// Compute the smoothness penalty of assignments (p1,p1+d) and (p2,p2+d)
-int Match::smoothness_penalty(Coord p1, Coord p2, int d) const {
-    return (imLeft?
-            smoothness_penalty_gray (p1,p2,d):
-            smoothness_penalty_color(p1,p2,d));
+/// Smoothness penalty of neighbor pixels p1 and p2 of disparities d1 and d2.
+inline int Match::pair_penalty(Coord p1, Coord p2, int d1, int d2) const {
+    if(d1==d2) return 0; // smoothness satisfied
+    int V = 0;
+    if(d1!=OCCLUDED && inRect(p2+d1,imSizeR))
+        V += smoothness_penalty(p1, p2, d1);
+    if(d2!=OCCLUDED && inRect(p1+d2,imSizeR))
+        V += smoothness_penalty(p1, p2, d2);
+    return V;
 }
 
 /// Compute current energy.
-/// We use this function only for sanity check.
-int Match::ComputeEnergy() const {
-    int E = 0;
+/// We use this function only for the initial labeling and for verification of
+/// the incremental update of the energy, see SetVerification.
+template <class Im, int Norm>
+long long Match::ComputeEnergy() const {
+    long long E = 0;
 
     RectIterator end=rectEnd(imSizeL);
     for(RectIterator p1=rectBegin(imSizeL); p1!=end; ++p1) {
-        int d1 = IMREF(d_left,*p1);
+        int d1 = disp(*p1);
         if(d1!=OCCLUDED)
-            E += data_occlusion_penalty(*p1, *p1+d1);
+            E += data_occlusion_penalty<Im,Norm>(*p1, *p1+d1);
 
         for(unsigned int k=0; k<NEIGHBOR_NUM; k++) {
             Coord p2 = *p1 + NEIGHBORS[k];
-            if(inRect(p2,imSizeL)) {
-                int d2 = IMREF(d_left, p2);
-                if(d1==d2) continue; // smoothness satisfied
-                if(d1!=OCCLUDED && inRect( p2+d1,imSizeR))
-                    E += smoothness_penalty(*p1, p2, d1);
-                if(d2!=OCCLUDED && inRect(*p1+d2,imSizeR))
-                    E += smoothness_penalty(*p1, p2, d2);
-            }
+            if(inRect(p2,imSizeL))
+                E += pair_penalty(*p1, p2, d1, disp(p2));
         }
     }
 
     return E;
 }
 
-/// VAR_ALPHA means disparity alpha before expansion move (in vars0 and varsA)
-static const Energy::Var VAR_ALPHA     = ((Energy::Var)-1);
-/// VAR_ABSENT means occlusion in vars0, and p+alpha outside image in varsA
-static const Energy::Var VAR_ABSENT = ((Energy::Var)-2);
+/// Change of the smoothness penalty of neighbors p and q, q of disparity dq,
+/// when the disparity of p changes from d0 to d1. Only the terms that differ
+/// are computed, see pair_penalty.
+inline int Match::pair_change(Coord p, Coord q, int d0, int d1, int dq) const {
+    int V = 0;
+    if(d1!=dq && d1!=OCCLUDED && inRect(q+d1,imSizeR))
+        V += smoothness_penalty(p, q, d1);
+    if(d0!=dq && d0!=OCCLUDED && inRect(q+d0,imSizeR))
+        V -= smoothness_penalty(p, q, d0);
+    if((d0==dq)!=(d1==dq) && dq!=OCCLUDED && inRect(p+dq,imSizeR)) {
+        int v = smoothness_penalty(p, q, dq);
+        V += (d0==dq)? v: -v;
+    }
+    return V;
+}
+
+/// Set disparity of pixel p to d, and update the energy accordingly, from
+/// the terms involving p.
+template <class Im, int Norm>
+inline void Match::change_disparity(Coord p, int d) {
+    const int d0 = disp(p);
+    if(d0!=OCCLUDED) E -= data_occlusion_penalty<Im,Norm>(p, p+d0);
+    if(d !=OCCLUDED) E += data_occlusion_penalty<Im,Norm>(p, p+d);
+    for(unsigned int k=0; k<NEIGHBOR_NUM; k++) {
+        Coord q = p + NEIGHBORS[k];
+        if(inRect(q,imSizeL))
+            E += pair_change(p, q, d0, d, disp(q));
+        q = Coord(p.x-NEIGHBORS[k].x, p.y-NEIGHBORS[k].y);
+        if(inRect(q,imSizeL))
+            E += pair_change(p, q, d0, d, disp(q));
+    }
+    set_disp(p, d);
+}
+
+/// Check that the energy, updated incrementally, is the one of the current
+/// disparity map. Exit on error.
+template <class Im, int Norm>
+void Match::verify_energy() const {
+    long long trueE = ComputeEnergy<Im,Norm>();
+    if(trueE != E) {
+        std::cerr << "Error in KZ2: energy is " << trueE
+                  << ", incremental update gives " << E << std::endl;
+        exit(1);
+    }
+}
+
+/// VAR_ALPHA means disparity alpha before expansion move (in var0 and varA)
+static const long long VAR_ALPHA  = -1;
+/// VAR_ABSENT means occlusion in var0, and p+alpha outside image in varA
+static const long long VAR_ABSENT = -2;
 /// Indicate if the variable has a regular value
-inline bool IS_VAR(Energy::Var var) { return (var>=0); }
+inline bool IS_VAR(long long var) { return (var>=0); }
+
+/// The variables of pixel p are packed in vars_at(p): VARS_ALPHA if its
+/// disparity is alpha before expansion, otherwise 4 times the id of its first
+/// node, plus 1 if var0 exists, plus 2 if varA exists. When both exist, varA is
+/// the node after var0, since build_nodes creates them in sequence.
+/// The type T is the index type of the graph. Node ids of 32-bit graphs are
+/// less than 2^29, see large_graphs, so that they fit.
+static const long long VARS_ALPHA = -1;
+
+/// Pack the variables o (in A^0) and a (in A^alpha) of a pixel
+template <typename T>
+inline T pack_vars(T o, T a) {
+    if(! IS_VAR(o))
+        return IS_VAR(a)? (a<<2 | 2): 0;
+    assert(!IS_VAR(a) || a==o+1);
+    return (o<<2 | 1 | (IS_VAR(a)? 2: 0));
+}
+
+/// Variable of the assignment in A^0 from packed variables of the pixel
+template <typename T>
+inline T var0(T vars) {
+    if(vars==VARS_ALPHA) return VAR_ALPHA;
+    return (vars&1)? (vars>>2): VAR_ABSENT;
+}
+
+/// Variable of the assignment in A^alpha from packed variables of the pixel
+template <typename T>
+inline T varA(T vars) {
+    if(vars==VARS_ALPHA) return VAR_ALPHA;
+    return (vars&2)? (vars>>2)+(vars&1): VAR_ABSENT;
+}
 
 /// Build nodes in graph representing data+occlusion penalty for pixel p.
 ///
 /// For assignments in A^0:       SOURCE means active, SINK means inactive.
 /// For assigments in A^{\alpha}: SOURCE means inactive, SINK means active.
-void Match::build_nodes(Energy& e, Coord p, int a) {
-    int d = IMREF(d_left, p);
+template <class Im, int Norm, class G>
+inline void Match::build_nodes(G& e, Coord p, int a) {
+    int d = disp(p);
     Coord q = p+d;
     if(a==d) { // active assignment (p,p+a) in A^a will remain active
-        IMREF(vars0, p) = VAR_ALPHA;
-        IMREF(varsA, p) = VAR_ALPHA;
-        e.add_constant(data_occlusion_penalty(p,q));
+        vars_at<G>(p) = VARS_ALPHA;
+        e.add_constant(data_occlusion_penalty<Im,Norm>(p,q));
         return;
     }
 
-    IMREF(vars0, p) = (d!=OCCLUDED)? // (p,p+d) in A^0 can remain active
-        e.add_variable(data_occlusion_penalty(p,q), 0): VAR_ABSENT;
+    typename G::Var o = (d!=OCCLUDED)? // (p,p+d) in A^0 can remain active
+        e.add_variable(data_occlusion_penalty<Im,Norm>(p,q), 0): VAR_ABSENT;
 
     q = p+a;
-    IMREF(varsA, p) = inRect(q,imSizeR)? // (p,p+a) in A^a can become active
-        e.add_variable(0, data_occlusion_penalty(p,q)): VAR_ABSENT;
+    typename G::Var va = inRect(q,imSizeR)? // (p,p+a) in A^a can become active
+        e.add_variable(0, data_occlusion_penalty<Im,Norm>(p,q)): VAR_ABSENT;
+    vars_at<G>(p) = pack_vars(o, va);
 }
 
 /// Build smoothness term for neighbor pixels p1 and p2 with disparity a.
-void Match::build_smoothness(Energy& e, Coord p1, Coord p2, int a) {
-    int d1 = IMREF(d_left, p1);
-    Energy::Var o1 = (Energy::Var) IMREF(vars0, p1);
-    Energy::Var a1 = (Energy::Var) IMREF(varsA, p1);
+template <class G>
+inline void Match::build_smoothness(G& e, Coord p1, Coord p2, int a) {
+    int d1 = disp(p1);
+    typename G::Var v1 = vars_at<G>(p1);
+    typename G::Var o1 = var0(v1);
+    typename G::Var a1 = varA(v1);
 
-    int d2 = IMREF(d_left, p2);
-    Energy::Var o2 = (Energy::Var) IMREF(vars0, p2);
-    Energy::Var a2 = (Energy::Var) IMREF(varsA, p2);
+    int d2 = disp(p2);
+    typename G::Var v2 = vars_at<G>(p2);
+    typename G::Var o2 = var0(v2);
+    typename G::Var a2 = varA(v2);
 
     // disparity a
     if(a1!=VAR_ABSENT && a2!=VAR_ABSENT) {
@@ -139,136 +238,738 @@ void Match::build_smoothness(Energy& e, Coord p1, Coord p2, int a) {
 /// Build edges in graph enforcing uniqueness at pixels p and p+d:
 /// - Prevent (p,p+d) and (p,p+a) from being both active.
 /// - Prevent (p,p+d) and (p+d-alpha,p+d) from being both active.
-void Match::build_uniqueness(Energy& e, Coord p, int alpha) {
-    Energy::Var o = (Energy::Var) IMREF(vars0, p);
+template <class G>
+void Match::build_uniqueness(G& e, Coord p, int alpha) {
+    typename G::Var v = vars_at<G>(p);
+    typename G::Var o = var0(v);
     if(! IS_VAR(o))
         return;
 
     // Enfore unique image of p
-    Energy::Var a = (Energy::Var) IMREF(varsA, p);
+    typename G::Var a = varA(v);
     if(a!=VAR_ABSENT)
         e.forbid01(o,a);
 
     // Enforce unique antecedent of p+d
-    int d = IMREF(d_left, p);
+    int d = disp(p);
     assert(d!=OCCLUDED);
     p = p+(d-alpha);
     if(inRect(p,imSizeL)) {
-        a = (Energy::Var) IMREF(varsA, p);
+        a = varA(vars_at<G>(p));
         assert(IS_VAR(a)); // not active because of current uniqueness
         e.forbid01(o, a);
     }
 }
 
-/// Update the disparity map according to min cut of energy.
-void Match::update_disparity(const Energy& e, int alpha) {
+/// Extract from the min cut of energy the pixels changing disparity, with
+/// their new disparity, in one pass. A pixel whose assignment (p,p+alpha)
+/// becomes active takes disparity alpha, since uniqueness makes its previous
+/// assignment inactive. Otherwise it is occluded if its previous assignment
+/// becomes inactive. For a fusion move, alpha is given per pixel by the
+/// \a proposal, otherwise it is null.
+template <class G>
+const std::vector<Match::Change>& Match::extract_changes(const G& e,
+                                                         int alpha,
+                                                         Gray16Image proposal){
+    changes.clear();
     RectIterator end=rectEnd(imSizeL);
     for(RectIterator p=rectBegin(imSizeL); p!=end; ++p) {
-        Energy::Var o = (Energy::Var) IMREF(vars0,*p);
-        if(IS_VAR(o) && e.get_var(o)==1)
-            IMREF(d_left,*p) = OCCLUDED;
-    }
-    for(RectIterator p=rectBegin(imSizeL); p!=end; ++p) {
-        Energy::Var a = (Energy::Var) IMREF(varsA,*p);
+        typename G::Var v = vars_at<G>(*p);
+        if(v==VARS_ALPHA) continue;
+        typename G::Var a = varA(v);
         if(IS_VAR(a) && e.get_var(a)==1) // New disparity
-            IMREF(d_left,*p) = alpha;
+            changes.push_back(Change(*p, proposal? disp(proposal,*p): alpha));
+        else {
+            typename G::Var o = var0(v);
+            if(IS_VAR(o) && e.get_var(o)==1)
+                changes.push_back(Change(*p, OCCLUDED));
+        }
     }
+    return changes;
+}
+
+/// Update the disparity map according to min cut of energy, and the energy
+/// from the changed pixels.
+template <class Im, int Norm, class G>
+void Match::update_disparity(const G& e, int alpha,
+                             Gray16Image proposal) {
+    const std::vector<Change>& c = extract_changes(e, alpha, proposal);
+    for(std::vector<Change>::const_iterator it=c.begin(); it!=c.end(); ++it)
+        change_disparity<Im,Norm>(it->p, it->d);
+    stats.changes += (long)c.size();
 }
 
 /// Compute the minimum a-expansion configuration.
 ///
 /// Return whether the move is different from identity.
+template <class Im, int Norm, class G>
 bool Match::ExpansionMove(int a) {
     // Factors 2 and 12 are minimal ensuring no reallocation
-    Energy e(2*imSizeL.x*imSizeL.y, 12*imSizeL.x*imSizeL.y);
+    const typename G::Var n = (typename G::Var)imSizeL.x*imSizeL.y;
+    G e(2*n, 12*n);
 
     // Build graph
-    RectIterator endL=rectEnd(imSizeL);
-    for(RectIterator p=rectBegin(imSizeL); p!=endL; ++p)
-        build_nodes(e, *p, a);
+    double t0 = elapsed_time();
+    // One pass over bands of rows: the terms of a band involve its nodes and
+    // those of the next band. Nodes and terms are in tile order.
+    const Coord tile = node_tile();
+    const int w = imSizeL.x;
+    int y0=0, y1=std::min(tile.y,imSizeL.y);
+    TileIterator end=tileEnd(w,y0,y1,tile.x);
+    for(TileIterator p=tileBegin(w,y0,y1,tile.x); p!=end; ++p)
+        build_nodes<Im,Norm,G>(e, *p, a);
+    for(; y0<imSizeL.y; y0=y1) {
+        y1 = std::min(y0+tile.y, imSizeL.y);
+        int y2 = std::min(y1+tile.y, imSizeL.y);
+        end = tileEnd(w,y1,y2,tile.x);
+        for(TileIterator q=tileBegin(w,y1,y2,tile.x); q!=end; ++q)
+            build_nodes<Im,Norm,G>(e, *q, a);
+        end = tileEnd(w,y0,y1,tile.x);
+        for(TileIterator p=tileBegin(w,y0,y1,tile.x); p!=end; ++p) {
+            for(unsigned int k=0; k<NEIGHBOR_NUM; k++) {
+                Coord p2 = *p+NEIGHBORS[k];
+                if(inRect(p2,imSizeL))
+                    build_smoothness(e, *p, p2, a);
+            }
+            build_uniqueness(e, *p, a);
+        }
+    }
 
-    for(RectIterator p1=rectBegin(imSizeL); p1!=endL; ++p1)
-        for(unsigned int k=0; k<NEIGHBOR_NUM; k++) {
-            Coord p2 = *p1+NEIGHBORS[k];
-            if(inRect(p2,imSizeL))
-                build_smoothness(e, *p1, p2, a);
+    double t1 = elapsed_time();
+    if(! graphDump.empty()) {
+        std::ostringstream name;
+        name << graphDump << '_' << stats.moves << '_' << a << ".graph";
+        if(! e.save(name.str().c_str()))
+            std::cerr << "Unable to save graph " << name.str() << std::endl;
+        t1 = elapsed_time();
+    }
+    // Max-flow, give the lowest-energy expansion move
+    typename G::TotalValue newE = e.minimize(reduceGraphs);
+    double t2 = elapsed_time();
+    stats.tBuild += t1-t0;
+    stats.tMaxflow += t2-t1;
+    ++stats.moves;
+    stats.growths += e.get_stats().growths;
+    stats.augmentations += e.get_stats().augmentations;
+    stats.orphans += e.get_stats().orphans;
+    stats.fixed += e.get_stats().fixed;
+
+    if(newE<E) { // lower energy, accept the expansion move
+        update_disparity<Im,Norm,G>(e, a);
+        assert(E==newE);
+        if(verification==VERIFY_EVERY)
+            verify_energy<Im,Norm>();
+        stats.tUpdate += elapsed_time()-t2;
+        ++stats.accepted;
+        return true;
+    }
+    return false;
+}
+
+/// Whether the changes \a c of an expansion move of label \a a interact with
+/// moves applied before: pixels of \a c are \a near pixels changed by these
+/// moves, or pixels of \a c take right pixels they have \a claimed. Otherwise,
+/// the energy changes of the moves add up, and the uniqueness constraint holds.
+bool Match::conflicts(const std::vector<Change>& c, int a,
+                      const std::vector<bool>& near,
+                      const std::vector<bool>& claimed) const {
+    std::vector<Change>::const_iterator it=c.begin();
+    for(; it!=c.end(); ++it) {
+        if(near[it->p.y*imSizeL.x+it->p.x])
+            return true;
+        if(it->d==a && claimed[it->p.y*imSizeR.x+it->p.x+a])
+            return true;
+    }
+    return false;
+}
+
+/// Speculative alpha-expansions of \a labels (disparities minus dispMin),
+/// computed concurrently by the workers from the current disparity map. The
+/// moves decreasing the energy are applied by decreasing energy drop, except
+/// those conflicting with the moves applied before them. A conflicting move
+/// may still decrease the energy, so its label is not done: it is computed
+/// again later. Whether each move is applied is written in \a accepted.
+template <class Im, int Norm, class G>
+void Match::parallel_moves(const std::vector<int>& labels,
+                           std::vector<bool>& accepted) {
+    const int n = (int)labels.size();
+    const size_t size = (size_t)imSizeL.x*imSizeL.y;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(n)
+#endif
+    for(int i=0; i<n; i++) {
+        Match& w = *workers[i];
+        std::copy(d_left->data, d_left->data+size, w.d_left->data);
+        w.E = E;
+        w.changes.clear();
+        w.stats.moves = stats.moves+i; // Number of the move in graph dump
+        w.ExpansionMove<Im,Norm,G>(dispMin+labels[i]);
+    }
+
+    // Order of moves by energy after move, the lowest first
+    std::vector< std::pair<long long,int> > order;
+    for(int i=0; i<n; i++) {
+        Match& w = *workers[i];
+        stats.tBuild += w.stats.tBuild;
+        stats.tMaxflow += w.stats.tMaxflow;
+        stats.growths += w.stats.growths;
+        stats.augmentations += w.stats.augmentations;
+        stats.orphans += w.stats.orphans;
+        stats.fixed += w.stats.fixed;
+        Stats zero = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+        w.stats = zero;
+        if(w.E < E)
+            order.push_back(std::make_pair(w.E, i));
+    }
+    stats.moves += n;
+    std::sort(order.begin(), order.end());
+
+    double t0 = elapsed_time();
+    const long long E0 = E; // Energy of the disparity map of the moves
+    long long expected = E; // Energy after the moves applied so far
+    accepted.assign(n, false);
+    std::vector<bool> near(size, false);
+    std::vector<bool> claimed((size_t)imSizeR.x*imSizeR.y, false);
+    for(size_t k=0; k<order.size(); k++) {
+        const int i=order[k].second, a=dispMin+labels[i];
+        const std::vector<Change>& c = workers[i]->changes;
+        if(conflicts(c, a, near, claimed))
+            continue;
+        std::vector<Change>::const_iterator it=c.begin();
+        for(; it!=c.end(); ++it) {
+            change_disparity<Im,Norm>(it->p, it->d);
+            near[it->p.y*imSizeL.x+it->p.x] = true;
+            for(unsigned int j=0; j<NEIGHBOR_NUM; j++) {
+                Coord q = it->p+NEIGHBORS[j];
+                if(inRect(q,imSizeL)) near[q.y*imSizeL.x+q.x] = true;
+                q = Coord(it->p.x-NEIGHBORS[j].x, it->p.y-NEIGHBORS[j].y);
+                if(inRect(q,imSizeL)) near[q.y*imSizeL.x+q.x] = true;
+            }
+            if(it->d==a)
+                claimed[it->p.y*imSizeR.x+it->p.x+a] = true;
+        }
+        expected -= E0-order[k].first;
+        assert(E==expected); // Energy drops of non-conflicting moves add up
+        stats.changes += (long)c.size();
+        ++stats.accepted;
+        accepted[i] = true;
+    }
+    if(verification==VERIFY_EVERY && ! order.empty())
+        verify_energy<Im,Norm>();
+    stats.tUpdate += elapsed_time()-t0;
+}
+
+/// Make the assignments of row \a y of \a proposal unique and inside the right
+/// image: of two pixels matching the same right pixel, the one of higher
+/// data+occlusion penalty is occluded. Fill row \a y of \a owner with the x
+/// coordinate of the pixel matching each right pixel in the proposal, -1 if
+/// none.
+template <class Im, int Norm>
+void Match::sanitize_proposal(Gray16Image proposal, IntImage owner, int y) {
+    for(int x=0; x<imSizeR.x; x++)
+        IMREF(owner,Coord(x,y)) = -1;
+    for(Coord p(0,y); p.x<imSizeL.x; p.x++) {
+        int d = disp(proposal,p);
+        if(d==OCCLUDED) continue;
+        Coord q = p+d;
+        if(! inRect(q,imSizeR)) {
+            set_disp(proposal, p, OCCLUDED);
+            continue;
+        }
+        int& x = IMREF(owner,q);
+        if(x>=0) { // Conflict with pixel (x,y)
+            Coord p2(x,q.y);
+            if(data_occlusion_penalty<Im,Norm>(p2,q) <=
+               data_occlusion_penalty<Im,Norm>(p,q)) {
+                set_disp(proposal, p, OCCLUDED);
+                continue;
+            }
+            set_disp(proposal, p2, OCCLUDED);
         }
+        x = p.x;
+    }
+}
 
-    for(RectIterator p=rectBegin(imSizeL); p!=endL; ++p)
-        build_uniqueness(e, *p, a);
+/// Build nodes of fusion move for pixel p: its assignment in A^0 (current)
+/// and in A^1 (proposal), as in build_nodes. When they are equal, it remains.
+template <class Im, int Norm, class G>
+inline void Match::build_fusion_nodes(G& e, Coord p, Gray16Image proposal) {
+    int d0 = disp(p), d1 = disp(proposal,p);
+    if(d0==d1) { // Assignment (p,p+d0), if any, remains active
+        vars_at<G>(p) = VARS_ALPHA;
+        if(d0!=OCCLUDED)
+            e.add_constant(data_occlusion_penalty<Im,Norm>(p,p+d0));
+        return;
+    }
+    typename G::Var o = (d0!=OCCLUDED)?
+        e.add_variable(data_occlusion_penalty<Im,Norm>(p,p+d0), 0): VAR_ABSENT;
+    typename G::Var a = (d1!=OCCLUDED)?
+        e.add_variable(0, data_occlusion_penalty<Im,Norm>(p,p+d1)): VAR_ABSENT;
+    vars_at<G>(p) = pack_vars(o, a);
+}
 
-    int oldE=E;
-    E = e.minimize(); // Max-flow, give the lowest-energy expansion move
+/// Variable of assignment (p,p+d) in fusion move, \a inA0 telling whether it
+/// is in A^0 (0 means active) rather than in A^1 (1 means active). It is
+/// VAR_ALPHA if the assignment remains active, VAR_ABSENT if inactive.
+template <class G>
+typename G::Var Match::assignment(Coord p, int d, Gray16Image proposal,
+                                  bool& inA0) const {
+    typename G::Var v = vars_at<G>(p);
+    inA0 = (d==disp(p));
+    if(v==VARS_ALPHA)
+        return inA0? VAR_ALPHA: VAR_ABSENT;
+    if(inA0)
+        return var0(v);
+    return (d==disp(proposal,p))? varA(v): VAR_ABSENT;
+}
 
-    if(E<oldE) { // lower energy, accept the expansion move
-        update_disparity(e, a);
-        assert(ComputeEnergy()==E);
+/// Penalize by delta the different activity of two assignments, given by
+/// their variables as returned by Match::assignment.
+///
+/// For a variable x of A^0 and a variable y of A^1, the term is not
+/// submodular. It is replaced by delta*(1+x-y), an upper bound equal to it
+/// except for x=1 and y=0, which is not the current configuration.
+template <class G>
+static void add_smoothness(G& e, typename G::Var v1, bool inA0_1,
+                           typename G::Var v2, bool inA0_2, int delta) {
+    if(! IS_VAR(v1)) {
+        std::swap(v1, v2);
+        std::swap(inA0_1, inA0_2);
+    }
+    if(! IS_VAR(v1)) { // Both constant
+        if(v1!=v2)
+            e.add_constant(delta);
+    } else if(! IS_VAR(v2)) { // Penalize v1 inactive if v2 active and v.v.
+        bool penalize0 = (inA0_1!=(v2==VAR_ALPHA)); // Penalty when v1 is 0
+        e.add_term1(v1, penalize0? delta: 0, penalize0? 0: delta);
+    } else if(inA0_1==inA0_2)
+        e.add_term2(v1, v2, 0, delta, delta, 0);
+    else { // Upper bound
+        e.add_term1(inA0_1? v1: v2, 0, delta);
+        e.add_term1(inA0_1? v2: v1, delta, 0);
+    }
+}
+
+/// Build smoothness term of fusion move for neighbor pixels p1 and p2: for
+/// each disparity d of their assignments, penalize (p1,p1+d) and (p2,p2+d)
+/// having different activity.
+template <class G>
+void Match::build_fusion_smoothness(G& e, Coord p1, Coord p2,
+                                    Gray16Image proposal) {
+    int ds[4] = {disp(p1), disp(proposal,p1), disp(p2), disp(proposal,p2)};
+    for(int i=0; i<4; i++) {
+        int d = ds[i];
+        if(d==OCCLUDED || std::find(ds,ds+i,d)!=ds+i) // Occluded or done
+            continue;
+        if(!inRect(p1+d,imSizeR) || !inRect(p2+d,imSizeR))
+            continue;
+        bool inA0_1, inA0_2;
+        typename G::Var v1 = assignment<G>(p1, d, proposal, inA0_1);
+        typename G::Var v2 = assignment<G>(p2, d, proposal, inA0_2);
+        if(v1==v2 && !IS_VAR(v1)) // Same constant activity
+            continue;
+        add_smoothness(e, v1, inA0_1, v2, inA0_2,
+                       smoothness_penalty(p1, p2, d));
+    }
+}
+
+/// Build edges of fusion move enforcing uniqueness at pixels p and p+d, where
+/// d is its current disparity, as in build_uniqueness. The pixel matching p+d
+/// in the proposal is given by \a owner.
+template <class G>
+void Match::build_fusion_uniqueness(G& e, Coord p, IntImage owner) {
+    typename G::Var v = vars_at<G>(p);
+    typename G::Var o = var0(v);
+    if(! IS_VAR(o))
+        return;
+
+    // Enforce unique image of p
+    typename G::Var a = varA(v);
+    if(IS_VAR(a))
+        e.forbid01(o, a);
+
+    // Enforce unique antecedent of p+d
+    Coord q = p+disp(p);
+    int x = IMREF(owner, q);
+    if(x>=0 && x!=p.x) {
+        a = varA(vars_at<G>(Coord(x,p.y)));
+        assert(IS_VAR(a)); // not active because of current uniqueness
+        e.forbid01(o, a);
+    }
+}
+
+/// Compute the minimum fusion of the current disparity map with \a proposal:
+/// each pixel keeps its disparity, takes the one of the proposal or becomes
+/// occluded. Current assignments form A^0 and those of the proposal A^1, the
+/// graph is built as for the alpha-expansion. Beforehand, the proposal is made
+/// unique, see sanitize_proposal. The min cut minimizes an upper bound of the
+/// energy, see add_smoothness, so the energy is updated from the changes.
+///
+/// Return whether the energy decreased.
+template <class Im, int Norm, class G>
+bool Match::FusionMove(Gray16Image proposal) {
+    IntImage owner = (IntImage)imNew(IMAGE_INT, imSizeR);
+    if(! owner)
+        { std::cerr << "Not enough memory!" << std::endl; exit(1); }
+    // Factors 2 and 20 are minimal ensuring no reallocation
+    const typename G::Var n = (typename G::Var)imSizeL.x*imSizeL.y;
+    G e(2*n, 20*n);
+
+    // Build graph
+    double t0 = elapsed_time();
+    // One pass over bands of rows, as in ExpansionMove
+    const Coord tile = node_tile();
+    const int w = imSizeL.x;
+    int y0=0, y1=std::min(tile.y,imSizeL.y);
+    for(int y=y0; y<y1; y++)
+        sanitize_proposal<Im,Norm>(proposal, owner, y);
+    TileIterator end=tileEnd(w,y0,y1,tile.x);
+    for(TileIterator p=tileBegin(w,y0,y1,tile.x); p!=end; ++p)
+        build_fusion_nodes<Im,Norm,G>(e, *p, proposal);
+    for(; y0<imSizeL.y; y0=y1) {
+        y1 = std::min(y0+tile.y, imSizeL.y);
+        int y2 = std::min(y1+tile.y, imSizeL.y);
+        for(int y=y1; y<y2; y++)
+            sanitize_proposal<Im,Norm>(proposal, owner, y);
+        end = tileEnd(w,y1,y2,tile.x);
+        for(TileIterator q=tileBegin(w,y1,y2,tile.x); q!=end; ++q)
+            build_fusion_nodes<Im,Norm,G>(e, *q, proposal);
+        end = tileEnd(w,y0,y1,tile.x);
+        for(TileIterator p=tileBegin(w,y0,y1,tile.x); p!=end; ++p) {
+            for(unsigned int k=0; k<NEIGHBOR_NUM; k++) {
+                Coord p2 = *p+NEIGHBORS[k];
+                if(inRect(p2,imSizeL))
+                    build_fusion_smoothness(e, *p, p2, proposal);
+            }
+            build_fusion_uniqueness(e, *p, owner);
+        }
+    }
+
+    double t1 = elapsed_time();
+    // Max-flow, give an upper bound of the energy after fusion
+    typename G::TotalValue newE = e.minimize(reduceGraphs);
+    double t2 = elapsed_time();
+    stats.tBuild += t1-t0;
+    stats.tMaxflow += t2-t1;
+    stats.growths += e.get_stats().growths;
+    stats.augmentations += e.get_stats().augmentations;
+    stats.orphans += e.get_stats().orphans;
+    stats.fixed += e.get_stats().fixed;
+    imFree(owner);
+
+    if(newE<E) { // lower energy, accept the fusion move
+        update_disparity<Im,Norm,G>(e, OCCLUDED, proposal);
+        assert(E<=newE);
+        if(verification==VERIFY_EVERY)
+            verify_energy<Im,Norm>();
+        stats.tUpdate += elapsed_time()-t2;
         return true;
     }
     return false;
 }
 
+/// Range move: fusion with the winner-take-all of block matching restricted
+/// to disparities in [a,b], so that each pixel can take one of these
+/// disparities, occlusion and uniqueness being handled as in FusionMove.
+/// The \a proposal is a buffer.
+///
+/// Return whether the energy decreased.
+template <class Im, int Norm, class G>
+bool Match::RangeMove(int a, int b, Gray16Image proposal) {
+    double t0 = elapsed_time();
+    block_matching<Im,Norm>(proposal, RANGE_RADIUS, a, b);
+    stats.tInit += elapsed_time()-t0;
+    ++stats.moves;
+    bool accepted = FusionMove<Im,Norm,G>(proposal);
+    stats.accepted += accepted;
+    return accepted;
+}
+
+/// Fusion moves with proposals: winner-take-all of block matching with
+/// windows of increasing size, then the disparity map shifted by one pixel
+/// in each direction, propagating disparities to neighbors.
+///
+/// Return the number of moves.
+template <class Im, int Norm, class G>
+int Match::fuse_proposals() {
+    static const int RADIUS[] = {1, 2, 4}; // Half-sizes of windows
+    static const Coord SHIFTS[] = { Coord(-1,0), Coord(1,0),
+                                    Coord(0,-1), Coord(0,1) };
+    Gray16Image proposal = (Gray16Image)imNew(IMAGE_GRAY16, imSizeL);
+    if(! proposal)
+        { std::cerr << "Not enough memory!" << std::endl; exit(1); }
+    for(unsigned int i=0; i<sizeof(RADIUS)/sizeof(int); i++) {
+        double t0 = elapsed_time();
+        block_matching<Im,Norm>(proposal, RADIUS[i], dispMin, dispMax);
+        stats.tInit += elapsed_time()-t0;
+        ++stats.moves;
+        bool accepted = FusionMove<Im,Norm,G>(proposal);
+        stats.accepted += accepted;
+        stats.fusions += accepted;
+        log(accepted? "*": "-");
+    }
+    RectIterator end=rectEnd(imSizeL);
+    for(unsigned int i=0; i<sizeof(SHIFTS)/sizeof(Coord); i++) {
+        double t0 = elapsed_time();
+        for(RectIterator p=rectBegin(imSizeL); p!=end; ++p) {
+            Coord q = *p+SHIFTS[i];
+            set_disp(proposal, *p, inRect(q,imSizeL)? disp(q): OCCLUDED);
+        }
+        stats.tInit += elapsed_time()-t0;
+        ++stats.moves;
+        bool accepted = FusionMove<Im,Norm,G>(proposal);
+        stats.accepted += accepted;
+        stats.fusions += accepted;
+        log(accepted? "*": "-");
+    }
+    imFree(proposal);
+    std::ostringstream str;
+    str << " E=" << E << " (fusion)" << '\n';
+    log(str.str());
+    return (int)(sizeof(RADIUS)/sizeof(int) + sizeof(SHIFTS)/sizeof(Coord));
+}
+
 /// Generate a random permutation of the array elements.
 ///
 /// Fisher-Yates shuffle: http://en.wikipedia.org/wiki/Fisher–Yates_shuffle
-static void generate_permutation(int *buf, int n) {
+void Match::generate_permutation(unsigned int& state, int *buf, int n) const {
     for(int i=0; i<n; i++) buf[i] = i;
-    for(int i=0; i<n-1; i++) {
-        int j = i + (int) (((double)rand()/RAND_MAX)*(n - i));
-        if(j >= n) // Very unlikely, but still possible
-            continue;
-        std::swap(buf[i],buf[j]);
+    for(int i=0; i<n-1; i++)
+        std::swap(buf[i], buf[i+random_below(state, n-i)]);
+}
+
+/// Winner-take-all disparities in [dMin,dMax] of the sums of data+occlusion
+/// penalties over windows of size (2*radius+1)^2, written in \a labels.
+/// Penalties of assignments outside the right image count as 0, like
+/// occlusion.
+///
+/// An assignment (p,p+d) is kept only if it has the lowest negative sum among
+/// the assignments of p and among those of p+d (left-right check). Its pixels
+/// have then no other active assignment, so the uniqueness constraint holds,
+/// and other pixels are occluded.
+template <class Im, int Norm>
+void Match::block_matching(Gray16Image labels, int radius,
+                           int dMin, int dMax) {
+    const int wL=imSizeL.x, wR=imSizeR.x, h=imSizeL.y;
+    // Penalties at disparity d, their horizontal sums and window sums
+    std::vector<int> cost(wL*h), hsum(wL*h), sum(wL*h);
+    // Lowest sum and its disparity for left and right pixels
+    std::vector<int> minL(wL*h,0), dL(wL*h,OCCLUDED);
+    std::vector<int> minR(wR*h,0), dR(wR*h,OCCLUDED);
+    for(int d=dMin; d<=dMax; d++) {
+        const int x0=std::max(0,-d), x1=std::min(wL,wR-d);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for(int y=0; y<h; y++) {
+            int *c=&cost[y*wL], *s=&hsum[y*wL];
+            std::fill(c, c+wL, 0);
+            for(int x=x0; x<x1; x++)
+                c[x] = data_occlusion_penalty<Im,Norm>(Coord(x,y),
+                                                       Coord(x+d,y));
+            int v=0; // Running sum over [x-radius,x+radius]
+            for(int x=0; x<radius && x<wL; x++) v += c[x];
+            for(int x=0; x<wL; x++) {
+                if(x+radius<wL)  v += c[x+radius];
+                if(x-radius-1>=0) v -= c[x-radius-1];
+                s[x] = v;
+            }
+        }
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for(int y=0; y<h; y++) {
+            const int y0=std::max(0,y-radius), y1=std::min(h-1,y+radius);
+            int* s=&sum[y*wL];
+            std::copy(&hsum[y0*wL], &hsum[y0*wL]+wL, s);
+            for(int yy=y0+1; yy<=y1; yy++)
+                for(int x=0; x<wL; x++)
+                    s[x] += hsum[yy*wL+x];
+            for(int x=x0; x<x1; x++) {
+                int i=y*wL+x, j=y*wR+x+d;
+                if(s[x]<minL[i]) { minL[i] = s[x]; dL[i] = d; }
+                if(s[x]<minR[j]) { minR[j] = s[x]; dR[j] = d; }
+            }
+        }
     }
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for(int y=0; y<h; y++)
+        for(int x=0; x<wL; x++) {
+            int d = dL[y*wL+x];
+            if(d!=OCCLUDED && dR[y*wR+x+d]!=d)
+                d = OCCLUDED;
+            set_disp(labels, Coord(x,y), d);
+        }
 }
 
-/// Main algorithm: a series of alpha-expansions.
+/// Main algorithm: a series of alpha-expansions, for any image type and norm.
+///
+/// The dispatch is done once, all functions called in the loop of expansion
+/// moves are specialized.
 void Match::run() {
-    // Display 1 number after decimal separator for number of iterations
-    std::cout << std::fixed << std::setprecision(1);
-
-    const int dispSize = dispMax-dispMin+1;
-    int* permutation = new int[dispSize]; // random permutation
+    KERNEL_DISPATCH(run, ());
+}
 
-    E = ComputeEnergy();
-    std::cout << "E=" << E << std::endl;
+/// Moves over windows of \a range consecutive labels, in random order, until
+/// none decreases the energy or params.maxIter iterations. A range of 1 means
+/// alpha-expansions, otherwise range moves using buffer \a proposal.
+/// With workers, alpha-expansions are computed by batches of as many labels,
+/// see parallel_moves.
+///
+/// Return the number of labels of the moves.
+template <class Im, int Norm, class G>
+int Match::sweep(int range, unsigned int& state, Gray16Image proposal) {
+    const int n = (dispMax-dispMin+range)/range; // Number of windows
+    int* permutation = new int[n]; // random permutation
+    bool* done = new bool[n]; // Can move of window decrease energy?
+    std::fill_n(done, n, false);
+    int nDone = n; // number of 'false' entries in 'done'
 
-    bool* done = new bool[dispSize]; // Can expansion of label decrease energy?
-    std::fill_n(done, dispSize, false);
-    int nDone = dispSize; // number of 'false' entries in 'done'
+    const size_t batch = (range==1 && !workers.empty())? workers.size(): 1;
+    std::vector<int> labels; // Labels of a batch
+    std::vector<bool> accepted(1); // Whether each move is accepted
 
     int step=0;
+    std::ostringstream str;
     for(int iter=0; iter<params.maxIter && nDone>0; iter++) {
         if(iter==0 || params.bRandomizeEveryIteration)
-            generate_permutation(permutation, dispSize);
-
-        for(int index=0; index<dispSize; index++) {
-            int label = permutation[index];
-            if(done[label]) continue;
-            ++step;
-
-            if( ExpansionMove(dispMin+label) ) {
-                std::fill_n(done, dispSize, false);
-                nDone = dispSize;
-                std::cout << '*';
-            } else
-                std::cout << '-';
-            std::cout << std::flush;
-            done[label] = true;
-            --nDone;
+            generate_permutation(state, permutation, n);
+
+        for(int index=0; index<n;) {
+            labels.clear();
+            for(; index<n && labels.size()<batch; index++)
+                if(! done[permutation[index]])
+                    labels.push_back(permutation[index]);
+            if(labels.empty()) continue;
+
+            if(labels.size()>1) {
+                parallel_moves<Im,Norm,G>(labels, accepted);
+                step += (int)labels.size();
+            } else if(range==1) {
+                accepted[0] = ExpansionMove<Im,Norm,G>(dispMin+labels[0]);
+                ++step;
+            } else {
+                int a = dispMin+labels[0]*range;
+                int b = std::min(dispMax, a+range-1);
+                accepted[0] = RangeMove<Im,Norm,G>(a, b, proposal);
+                step += b-a+1;
+            }
+            // After an accepted move, only its label is done
+            bool any = std::count(accepted.begin(),
+                                  accepted.begin()+labels.size(), true) > 0;
+            if(any) {
+                std::fill_n(done, n, false);
+                nDone = n;
+            }
+            for(size_t i=0; i<labels.size(); i++) {
+                log(accepted[i]? "*": "-");
+                if(accepted[i] || !any) {
+                    done[labels[i]] = true;
+                    --nDone;
+                }
+            }
         }
-        std::cout << " E=" << E << std::endl;
+        if(verification==VERIFY_SAMPLED)
+            verify_energy<Im,Norm>();
+        str.str("");
+        str << " E=" << E;
+        if(range>1)
+            str << " (range " << range << ')';
+        str << '\n';
+        log(str.str());
     }
 
-    std::cout << (float)step/dispSize << " iterations" << std::endl;
-
     delete [] permutation;
     delete [] done;
+    return step;
 }
 
-/// Main algorithm
-void Match::KZ2() {
+/// Whether node or arc indices of the graphs may overflow 32-bit integers.
+/// The largest graphs, those of fusion moves, have up to 20 arcs per pixel.
+bool Match::large_graphs() const {
+    return (20*((long long)imSizeL.x*imSizeL.y) > INT_MAX);
+}
+
+/// Allocate the packed variables of pixels in the index type of the graphs.
+void Match::alloc_vars() {
+    size_t n = (size_t)imSizeL.x*imSizeL.y;
+    std::vector<int>().swap(vars);
+    std::vector<long long>().swap(varsLarge);
+    if(large_graphs())
+        varsLarge.resize(n);
+    else
+        vars.resize(n);
+}
+
+/// Main algorithm for an image type and norm: graphs of 32-bit indices,
+/// unless the image is too large for them, see large_graphs.
+template <class Im, int Norm>
+void Match::run() {
+    if(large_graphs()) {
+        log("64-bit graphs\n");
+        optimize<Im,Norm,LargeEnergy>();
+    } else
+        optimize<Im,Norm,Energy>();
+}
+
+/// Main algorithm: a series of alpha-expansions.
+///
+/// They may be preceded by winner-take-all initialization, fusion moves and
+/// range moves, depending on parameters.
+template <class Im, int Norm, class G>
+void Match::optimize() {
+    const int dispSize = dispMax-dispMin+1;
+    unsigned int state = seed; // Same seed, same alpha order
+
+    Stats zero = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    stats = zero;
+    if(params.bInitWTA) {
+        double t0 = elapsed_time();
+        block_matching<Im,Norm>(d_left, 0, dispMin, dispMax);
+        stats.tInit = elapsed_time()-t0;
+    }
+    E = ComputeEnergy<Im,Norm>();
+    std::ostringstream str;
+    str << "E=" << E << '\n';
+    log(str.str());
+    int step=0; // Number of labels of moves, 1 for a fusion move
+    if(params.bFusion)
+        step += fuse_proposals<Im,Norm,G>();
+
+    if(params.parallelMoves>1) // Matchers of concurrent alpha-expansions
+        for(int i=0; i<params.parallelMoves; i++)
+            workers.push_back(new Match(*this, WorkerTag()));
+
+    if(params.rangeSize>1 && params.rangeSize<dispSize) {
+        Gray16Image proposal = (Gray16Image)imNew(IMAGE_GRAY16, imSizeL);
+        if(! proposal)
+            { std::cerr << "Not enough memory!" << std::endl; exit(1); }
+        step += sweep<Im,Norm,G>(params.rangeSize, state, proposal);
+        imFree(proposal);
+    }
+    step += sweep<Im,Norm,G>(1, state, 0);
+    for(size_t i=0; i<workers.size(); i++)
+        delete workers[i];
+    workers.clear();
+
+    stats.iterations = (float)step/dispSize;
+    stats.E = E;
+    // Display 1 number after decimal separator for number of iterations
+    str.str("");
+    str << std::fixed << std::setprecision(1)
+        << stats.iterations << " iterations" << '\n';
+    log(str.str());
+}
+
+/// Check parameters, exit on error, and display them.
+void Match::check_parameters() const {
     if(params.K<0 || params.edgeThresh<0 ||
-        params.lambda1<0 || params.lambda2<0 || params.denominator<1) {
+        params.cutoff<1 || params.cutoff>=32 || // See MAX_DENOM in match.cpp
+        params.lambda1<0 || params.lambda2<0 || params.denominator<1 ||
+        params.denominator%GetDenominatorStep()!=0 || params.rangeSize<1 ||
+        params.parallelMoves<1) {
         std::cerr << "Error in KZ2: wrong parameter!" << std::endl;
         exit(1);
     }
@@ -279,12 +980,45 @@ void Match::KZ2() {
         s << params.denominator;
         strDenom = "/" + s.str();
     }
-    std::cout << "KZ2:  K=" << params.K << strDenom <<std::endl
-              << "      edgeThreshold=" << params.edgeThresh
-              << ", lambda1=" << params.lambda1 << strDenom
-              << ", lambda2=" << params.lambda2 << strDenom
-              << ", dataCost = L" <<
-        ((params.dataCost==Parameters::L1)? '1': '2') << std::endl;
+    std::ostringstream str;
+    str << "KZ2:  K=" << params.K << strDenom << '\n'
+        << "      edgeThreshold=" << params.edgeThresh
+        << ", lambda1=" << params.lambda1 << strDenom
+        << ", lambda2=" << params.lambda2 << strDenom
+        << ", dataCost = L" <<
+        ((params.dataCost==Parameters::L1)? '1': '2') << '\n';
+    log(str.str());
+}
 
+/// Main algorithm
+void Match::KZ2() {
+    check_parameters();
     run();
 }
+
+/// Main algorithm in both directions, left to right and right to left,
+/// running concurrently if OpenMP is enabled. Only the progress of left to
+/// right is displayed. The images of intensity ranges are shared.
+void Match::KZ2LeftRight() {
+    check_parameters();
+    delete reverse;
+    reverse = new Match(*this, ReverseTag());
+#ifdef _OPENMP
+#pragma omp parallel sections num_threads(2)
+#endif
+    {
+#ifdef _OPENMP
+#pragma omp section
+#endif
+        run();
+#ifdef _OPENMP
+#pragma omp section
+#endif
+        reverse->run();
+    }
+    std::ostringstream str;
+    str << "Right to left: E=" << reverse->E << ", "
+        << std::fixed << std::setprecision(1)
+        << reverse->stats.iterations << " iterations" << '\n';
+    log(str.str());
+}
@@ -17,106 +17,51 @@
 
 #include "match.h"
 #include "cmdLine.h"
-#include <limits>
-#include <cmath>
 #include <ctime>
 
-/// Max denominator for fractions. We need to approximate float values as
-/// fractions since the max-flow is implemented using short integers. The
-/// denominator multiplies the data term in Match::data_occlusion_penalty. To
-/// avoid overflow, we have to make sure this stays below 2^15 (max short).
-/// The data term can reach (CUTOFF=30<2^5)^2<2^10 if using L2 norm, so a
-/// denominator up to 2^4 will reach 2^14 and not provoke overflow.
-static const int MAX_DENOM=1<<4;
-
-/// Is the color image actually gray?
-bool isGray(RGBImage im) {
-    const int xsize=imGetXSize(im), ysize=imGetYSize(im);
-    for(int y=0; y<ysize; y++)
-        for(int x=0; x<xsize; x++)
-            if(imRef(im,x,y).c[0] != imRef(im,x,y).c[1] ||
-               imRef(im,x,y).c[0] != imRef(im,x,y).c[2])
-                return false;
-    return true;
-}
-
-/// Convert to gray level a color image (extract red channel)
-void convert_gray(GeneralImage& im) {
-    const int xsize=imGetXSize(im), ysize=imGetYSize(im);
-    GrayImage g = (GrayImage)imNew(IMAGE_GRAY, xsize, ysize);
-    for(int y=0; y<ysize; y++)
-        for(int x=0; x<xsize; x++)
-            imRef(g,x,y) = imRef((RGBImage)im,x,y).c[0];
-    imFree(im);
-    im = (GeneralImage)g;
-}
-
-/// Store in \a params fractions approximating the last 3 parameters.
-///
-/// They have the same denominator (up to \c MAX_DENOM), chosen so that the sum
-/// of relative errors is minimized.
-void set_fractions(Match::Parameters& params,
-                   float K, float lambda1, float lambda2) {
-    float minError = std::numeric_limits<float>::max();
-    for(int i=1; i<=MAX_DENOM; i++) {
-        float e = 0;
-        int numK=0, num1=0, num2=0;
-        if(K>0)
-            e += std::abs((numK=int(i*K+.5f))/(i*K) - 1.0f);
-        if(lambda1>0)
-            e += std::abs((num1=int(i*lambda1+.5f))/(i*lambda1) - 1.0f);
-        if(lambda2>0)
-            e += std::abs((num2=int(i*lambda2+.5f))/(i*lambda2) - 1.0f);
-        if(e<minError) {
-            minError = e;
-            params.denominator = i;
-            params.K = numK;
-            params.lambda1 = num1;
-            params.lambda2 = num2;
-        }
-    }
-}
-
-/// Make sure parameters K, lambda1 and lambda2 are non-negative.
-///
-/// - K may be computed automatically and lambda set to K/5.
-/// - lambda1=3*lambda, lambda2=lambda
-/// As the graph requires integer weights, use fractions and common denominator.
-void fix_parameters(Match& m, Match::Parameters& params,
-                    float& K, float& lambda, float& lambda1, float& lambda2) {
-    if(K<0) { // Automatic computation of K
-        m.SetParameters(&params);
-        K = m.GetK();
-    }
-    if(lambda<0) // Set lambda to K/5
-        lambda = K/5;
-    if(lambda1<0) lambda1 = 3*lambda;
-    if(lambda2<0) lambda2 = lambda;
-    set_fractions(params, K, lambda1, lambda2);
-    m.SetParameters(&params);
-}
-
 /// Main program
 int main(int argc, char *argv[]) {
     Match::Parameters params = { // Default parameters
-        Match::Parameters::L2, 1, // dataCost, denominator
+        Match::Parameters::L2, 30, 1, // dataCost, cutoff, denominator
         8, -1, -1, // edgeThresh, lambda1, lambda2 (smoothness cost)
         -1,        // K (occlusion cost)
-        4, false   // maxIter, bRandomizeEveryIteration
+        4, false,  // maxIter, bRandomizeEveryIteration
+        false, false, // bInitWTA, bFusion
+        1, 1       // rangeSize, parallelMoves
     };
 
     CmdLine cmd;
-    std::string cost, sDisp;
-    float K=-1, lambda=-1, lambda1=-1, lambda2=-1;
+    std::string cost, sDisp, graphDump, sRight, sMask, sFit, sROI, sVerify;
+    int margin=16, rangeMargin=-1;
+    bool tiles=false, reduce=false;
+    float K=-1, lambda=-1, lambda1=-1, lambda2=-1, kSample=1, outliers=0.01f;
+    unsigned int seed = (unsigned int)time(NULL);
     cmd.add( make_option('i', params.maxIter, "max_iter") );
     cmd.add( make_option('o', sDisp, "output") );
+    cmd.add( make_option(0, sRight, "right") );
+    cmd.add( make_option(0, sMask, "lr_mask") );
+    cmd.add( make_option(0, sFit, "subpixel") );
+    cmd.add( make_option(0, sROI, "roi") );
+    cmd.add( make_option(0, margin, "margin") );
+    cmd.add( make_option(0, rangeMargin, "auto_range") );
+    cmd.add( make_option(0, outliers, "outliers") );
     cmd.add( make_switch('r', "random") );
+    cmd.add( make_option(0, params.bInitWTA, "wta") );
+    cmd.add( make_option(0, params.bFusion, "fusion") );
+    cmd.add( make_option(0, params.rangeSize, "range") );
+    cmd.add( make_option(0, params.parallelMoves, "parallel") );
+    cmd.add( make_option(0, tiles, "tiles") );
+    cmd.add( make_option(0, reduce, "reduce") );
     cmd.add( make_option('c', cost, "data_cost") );
     cmd.add( make_option('k', K) );
+    cmd.add( make_option(0, kSample, "k_sample") );
     cmd.add( make_option('l', lambda, "lambda") );
     cmd.add( make_option(0, lambda1, "lambda1") );
     cmd.add( make_option(0, lambda2, "lambda2") );
     cmd.add( make_option('t', params.edgeThresh, "threshold") );
+    cmd.add( make_option(0, graphDump, "dump_graphs") );
+    cmd.add( make_option(0, seed, "seed") );
+    cmd.add( make_option(0, sVerify, "verify") );
 
     cmd.process(argc, argv);
     if(argc != 5 && argc != 6) {
@@ -125,14 +70,45 @@ int main(int argc, char *argv[]) {
         std::cerr << "General options:" << '\n'
                   << " -i,--max_iter iter: max number of iterations" <<'\n'
                   << " -o,--output disp.png: scaled disparity map" <<'\n'
+                  << " --right dispR.tif: also compute right disparity map"
+                  <<'\n'
+                  << " --lr_mask mask.png: left-right consistency (255 if OK)"
+                  <<'\n'
+                  << " --subpixel fit: parabola or equiangular refinement of"
+                  << " float disparity maps" <<'\n'
+                  << " --roi x,y,w,h: compute disparity only in rectangle"
+                  <<'\n'
+                  << " --margin m: context around rectangle (16)" <<'\n'
+                  << " --auto_range m: restrict disparity range to sparse"
+                  << " matches, with margin m" <<'\n'
+                  << " --outliers f: fraction of sparse matches ignored at"
+                  << " each end (0.01)" <<'\n'
                   << " -r,--random: random alpha order at each iteration" <<'\n'
+                  << " --wta: initialize by winner-take-all with left-right"
+                  << " check" <<'\n'
+                  << " --fusion: fusion with block matching proposals before"
+                  << " alpha-expansions" <<'\n'
+                  << " --range r: moves over r labels before alpha-expansions"
+                  <<'\n'
+                  << " --parallel n: n concurrent alpha-expansions" <<'\n'
+                  << " --tiles: graph nodes numbered by tiles of pixels" <<'\n'
+                  << " --reduce: fix graph nodes of known value before max-flow"
+                  <<'\n'
+                  << " --seed s: seed of random alpha order (default: time)"
+                  <<'\n'
+                  << " --dump_graphs prefix: save graph of each expansion move"
+                  <<'\n'
+                  << " --verify level: recompute energy, off (default),"
+                  << " sampled (each iteration) or every (accepted move)" <<'\n'
                   << "Options for cost:" <<'\n'
                   << " -c,--data_cost dist: L1 or L2" <<'\n'
                   << " -l,--lambda lambda: value of lambda (smoothness)" <<'\n'
                   << " --lambda1 l1: smoothness cost not across edge" <<'\n'
                   << " --lambda2 l2: smoothness cost across edge" <<'\n'
                   << " -t,--threshold thres: intensity diff for 'edge'" <<'\n'
-                  << " -k k: cost for occlusion" <<std::endl;
+                  << " -k k: cost for occlusion" <<'\n'
+                  << " --k_sample f: estimate K from fraction f of pixels"
+                  << std::endl;
         return 1;
     }
 
@@ -148,19 +124,44 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    GeneralImage im1 = (GeneralImage)imLoad(IMAGE_RGB, argv[1]);
-    GeneralImage im2 = (GeneralImage)imLoad(IMAGE_RGB, argv[2]);
+    Match::SubPixelFit fit = Match::FIT_NONE;
+    if(sFit == "parabola")
+        fit = Match::FIT_PARABOLA;
+    else if(sFit == "equiangular")
+        fit = Match::FIT_EQUIANGULAR;
+    else if(! sFit.empty()) {
+        std::cerr << "The subpixel fit must be 'parabola' or 'equiangular'"
+                  << std::endl;
+        return 1;
+    }
+
+    Match::Verification verification = Match::VERIFY_OFF;
+    if(sVerify == "sampled")
+        verification = Match::VERIFY_SAMPLED;
+    else if(sVerify == "every")
+        verification = Match::VERIFY_EVERY;
+    else if(! sVerify.empty() && sVerify != "off") {
+        std::cerr << "The verify level must be 'off', 'sampled' or 'every'"
+                  << std::endl;
+        return 1;
+    }
+    if(kSample<=0 || kSample>1) {
+        std::cerr << "The k_sample fraction must be in (0,1]" << std::endl;
+        return 1;
+    }
+    if(outliers<0 || outliers>=0.5f) {
+        std::cerr << "The outliers fraction must be in [0,0.5)" << std::endl;
+        return 1;
+    }
+
+    GeneralImage im1 = (GeneralImage)imLoadGrayOrRGB(argv[1]);
+    GeneralImage im2 = (GeneralImage)imLoadGrayOrRGB(argv[2]);
     if(!im1 || !im2) {
         std::cerr << "Unable to read image " << argv[im1?2:1] << std::endl;
         return 1;
     }
-    bool color=true;
-    if(isGray((RGBImage)im1) && isGray((RGBImage)im2)) {
-        color=false;
-        convert_gray(im1);
-        convert_gray(im2);
-    }
-    Match m(im1, im2, color);
+    imConvertPair(im1, im2);
+    Match m(im1, im2);
 
     // Disparity
     int dMin=0, dMax=0;
@@ -169,18 +170,43 @@ int main(int argc, char *argv[]) {
         std::cerr << "Error reading dMin or dMax" << std::endl;
         return 1;
     }
+    if(! sROI.empty()) {
+        int x, y, w, h;
+        char c1=0, c2=0, c3=0;
+        std::istringstream r(sROI);
+        if(! ((r>>x>>c1>>y>>c2>>w>>c3>>h).eof() &&
+              c1==',' && c2==',' && c3==',')) {
+            std::cerr << "Error reading roi x,y,w,h" << std::endl;
+            return 1;
+        }
+        m.SetROI(x, y, w, h, margin);
+    }
     m.SetDispRange(dMin, dMax);
+    m.SetGraphDump(graphDump);
+    m.SetSeed(seed);
+    m.SetVerification(verification);
+    m.SetNodeOrder(tiles? Match::ORDER_TILES: Match::ORDER_RASTER);
+    m.SetGraphReduction(reduce);
 
-    time_t seed = time(NULL);
-    srand((unsigned int)seed);
-
-    fix_parameters(m, params, K, lambda, lambda1, lambda2);
-    if(argc>5 || !sDisp.empty()) {
-        m.KZ2();
+    if(rangeMargin>=0) {
+        m.SetParameters(&params);
+        m.EstimateDispRange(rangeMargin, outliers);
+    }
+    fix_parameters(m, params, K, lambda, lambda1, lambda2, kSample);
+    bool leftRight = (!sRight.empty() || !sMask.empty());
+    if(argc>5 || !sDisp.empty() || leftRight) {
+        if(leftRight)
+            m.KZ2LeftRight();
+        else
+            m.KZ2();
         if(argc>5)
-            m.SaveXLeft(argv[5]);
+            m.SaveXLeft(argv[5], fit);
         if(! sDisp.empty())
             m.SaveScaledXLeft(sDisp.c_str(), false);
+        if(! sRight.empty())
+            m.SaveXRight(sRight.c_str(), fit);
+        if(! sMask.empty())
+            m.SaveConsistency(sMask.c_str());
     } else {
         std::cout << "K=" << K << std::endl;
         std::cout << "lambda=" << lambda << std::endl;
@@ -21,76 +21,194 @@
 #include <algorithm>
 #include <limits>
 #include <iostream>
+#include <cmath>
+#include <cassert>
 
 const int Match::OCCLUDED = std::numeric_limits<int>::max();
 
-/// Constructor
-Match::Match(GeneralImage left, GeneralImage right, bool color) {
-    originalHeightL = imGetYSize(left);
-    int height = std::min(imGetYSize(left), imGetYSize(right));
-    imSizeL = Coord(imGetXSize(left), height);
-    imSizeR = Coord(imGetXSize(right),height);
+/// Default receiver of messages: standard output.
+static void log_cout(const std::string& message, void*) {
+    std::cout << message << std::flush;
+}
 
-    if (!color) {
-        imColorLeft = imColorRight = 0;
-        imColorLeftMin = imColorRightMin = 0;
-        imColorLeftMax = imColorRightMax = 0;
+/// Constructor. Both images must have the same type.
+Match::Match(GeneralImage left, GeneralImage right) {
+    init(left, right);
+    SetLog(log_cout);
+}
+
+/// Matcher from right to left image of \a m, in left-right mode. It shares
+/// the images of intensity ranges of \a m, and its disparity range and its
+/// parameters are set from \a m. It sends no message.
+Match::Match(const Match& m, ReverseTag) {
+    init(m.imRight, m.imLeft);
+    fullSizeL = m.fullSizeR; fullSizeR = m.fullSizeL;
+    origin = Coord(0, m.origin.y);
+    dispOffset = -m.dispOffset;
+    imLeftMin  = m.imRightMin; imLeftMax  = m.imRightMax;
+    imRightMin = m.imLeftMin;  imRightMax = m.imLeftMax;
+    imLeftEdge = m.imRightEdge; imRightEdge = m.imLeftEdge;
+    sharedSubPixel = true;
+    SetDispRange(-(m.dispMax-m.dispOffset), -(m.dispMin-m.dispOffset));
+    params = m.params;
+    seed = m.seed;
+    verification = m.verification;
+    nodeOrder = m.nodeOrder;
+    reduceGraphs = m.reduceGraphs;
+}
 
-        imLeft  = (GrayImage)left; imRight = (GrayImage)right;
-        imLeftMin = imLeftMax = imRightMin = imRightMax = 0;
-    } else {
-        imLeft = imRight = 0;
-        imLeftMin = imRightMin = 0;
-        imLeftMax = imRightMax = 0;
+/// Matcher of concurrent expansion moves of \a m, see parallel_moves. It
+/// shares the images of \a m, its disparity map and energy are set before
+/// each move. It sends no message.
+Match::Match(const Match& m, WorkerTag) {
+    init(m.imLeft, m.imRight);
+    imLeftMin  = m.imLeftMin;  imLeftMax  = m.imLeftMax;
+    imRightMin = m.imRightMin; imRightMax = m.imRightMax;
+    imLeftEdge = m.imLeftEdge; imRightEdge = m.imRightEdge;
+    sharedSubPixel = true;
+    dispMin = m.dispMin;
+    dispMax = m.dispMax;
+    params = m.params;
+    graphDump = m.graphDump;
+    seed = m.seed;
+    verification = m.verification;
+    nodeOrder = m.nodeOrder;
+    reduceGraphs = m.reduceGraphs;
+}
 
-        imColorLeft = (RGBImage)left;
-        imColorRight = (RGBImage)right;
+/// Initialize images and dimensions, without messages.
+void Match::init(GeneralImage left, GeneralImage right) {
+    int height = std::min(imGetYSize(left), imGetYSize(right));
+    imSizeL = Coord(imGetXSize(left), height);
+    imSizeR = Coord(imGetXSize(right),height);
+    fullSizeL = Coord(imGetXSize(left), imGetYSize(left));
+    fullSizeR = Coord(imGetXSize(right),imGetYSize(right));
+    origin = roiMin = Coord(0,0);
+    roiMax = imSizeL;
+    dispOffset = 0;
+    viewImages = false;
 
-        imColorLeftMin = imColorLeftMax = 0;
-        imColorRightMin = imColorRightMax = 0;
-    }
+    imType = imGetType(left);
+    if(imGetType(right) != imType)
+        { std::cerr << "Images of different types!" << std::endl; exit(1); }
+    imLeft = left; imRight = right;
+    imLeftMin = imLeftMax = imRightMin = imRightMax = 0;
+    imLeftEdge = imRightEdge = 0;
+    // Finer data cost for 16-bit images, see GetDenominatorStep
+    costShift = (imType==IMAGE_GRAY16 || imType==IMAGE_RGB16)? 2: 0;
 
     dispMin = dispMax = 0;
+    seed = 0;
+    verification = VERIFY_OFF;
+    nodeOrder = ORDER_RASTER;
+    reduceGraphs = false;
+    reverse = 0;
+    sharedSubPixel = false;
+    SetLog(0);
+    Stats zero = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    stats = zero;
 
-    d_left  = (IntImage)imNew(IMAGE_INT, imSizeL);
-    vars0 = (IntImage)imNew(IMAGE_INT, imSizeL);
-    varsA = (IntImage)imNew(IMAGE_INT, imSizeL);
-    if (!d_left || !vars0 || !varsA)
+    d_left = (Gray16Image)imNew(IMAGE_GRAY16, imSizeL);
+    alloc_vars();
+    if (!d_left)
         { std::cerr << "Not enough memory!" << std::endl; exit(1); }
 }
 
 /// Destructor
 Match::~Match() {
-    imFree(imLeftMin);
-    imFree(imLeftMax);
-    imFree(imRightMin);
-    imFree(imRightMax);
-    imFree(imColorLeftMin);
-    imFree(imColorLeftMax);
-    imFree(imColorRightMin);
-    imFree(imColorRightMax);
+    delete reverse;
+    if(! sharedSubPixel) {
+        imFree(imLeftMin);
+        imFree(imLeftMax);
+        imFree(imRightMin);
+        imFree(imRightMax);
+        imFree(imLeftEdge);
+        imFree(imRightEdge);
+    }
+    if(viewImages) {
+        imFreeView(imLeft);
+        imFreeView(imRight);
+    }
 
     imFree(d_left);
+}
 
-    imFree(vars0);
-    imFree(varsA);
+/// The denominator of parameters must be a multiple of this value.
+///
+/// The data cost of 16-bit images is computed with 2 more bits of precision,
+/// so that it is 4 times larger. Parameters::denominator is divided by 4 when
+/// multiplying the data cost, which keeps the same range of capacities.
+int Match::GetDenominatorStep() const {
+    return 1<<costShift;
 }
 
-/// Save disparity map as float TIFF image
-void Match::SaveXLeft(const char *fileName) {
-    Coord outSize(imSizeL.x,originalHeightL);
-    FloatImage out = (FloatImage)imNew(IMAGE_FLOAT,outSize);
+/// Return disparity map as new float image, NaN for occluded pixels.
+/// It has the original size of the left image, pixels outside the region of
+/// interest being NaN. The caller must imFree it.
+/// Disparities are refined to subpixel precision unless \a fit is FIT_NONE.
+FloatImage Match::GetXLeft(SubPixelFit fit) const {
+    FloatImage out = (FloatImage)imNew(IMAGE_FLOAT,fullSizeL);
 
-    RectIterator end=rectEnd(outSize);
-    for(RectIterator p=rectBegin(outSize); p!=end; ++p)
+    RectIterator end=rectEnd(fullSizeL);
+    for(RectIterator p=rectBegin(fullSizeL); p!=end; ++p)
         IMREF(out,*p) = NaN;
 
+    if(fit!=FIT_NONE) {
+        subpixel_disparities(out, fit);
+        return out;
+    }
+    for(int y=roiMin.y; y<roiMax.y; y++)
+        for(Coord p(roiMin.x,y); p.x<roiMax.x; p.x++) {
+            int d=disp(p);
+            if(d!=OCCLUDED)
+                IMREF(out,p+origin) = (float)(d-dispOffset);
+        }
+    return out;
+}
+
+/// Return disparity map of right image as new float image, computed by
+/// KZ2LeftRight. The caller must imFree it.
+FloatImage Match::GetXRight(SubPixelFit fit) const {
+    assert(reverse);
+    return reverse->GetXLeft(fit);
+}
+
+/// Return left-right consistency of disparity map as new gray image: 255 if
+/// the disparity of the right image at the matching pixel is the opposite, 0
+/// otherwise, in particular if occluded. Requires KZ2LeftRight.
+GrayImage Match::GetConsistency() const {
+    assert(reverse);
+    GrayImage out = (GrayImage)imNew(IMAGE_GRAY,fullSizeL);
+
+    RectIterator end=rectEnd(fullSizeL);
+    for(RectIterator p=rectBegin(fullSizeL); p!=end; ++p)
+        IMREF(out,*p) = 0;
+
     end=rectEnd(imSizeL);
     for(RectIterator p=rectBegin(imSizeL); p!=end; ++p) {
-        int d=IMREF(d_left,*p);
-        IMREF(out,*p) = (d==OCCLUDED? NaN: static_cast<float>(d));
+        int d=disp(*p);
+        if(in_roi(*p) && d!=OCCLUDED && reverse->disp(*p+d)==-d)
+            IMREF(out,*p+origin) = 255;
     }
+    return out;
+}
+
+/// Save disparity map as float TIFF image, NaN for occluded pixels.
+void Match::SaveXLeft(const char *fileName, SubPixelFit fit) {
+    FloatImage out = GetXLeft(fit);
+    imSave(out, fileName);
+    imFree(out);
+}
+
+/// Save right disparity map as float TIFF image, NaN for occluded pixels.
+void Match::SaveXRight(const char *fileName, SubPixelFit fit) {
+    assert(reverse);
+    reverse->SaveXLeft(fileName, fit);
+}
 
+/// Save left-right consistency as 8-bit image, see GetConsistency.
+void Match::SaveConsistency(const char *fileName) {
+    GrayImage out = GetConsistency();
     imSave(out, fileName);
     imFree(out);
 }
@@ -98,11 +216,10 @@ void Match::SaveXLeft(const char *fileName) {
 /// Save scaled disparity map as 8-bit color image (gray between 64 and 255).
 /// flag: lowest disparity should appear darkest (true) or brightest (false).
 void Match::SaveScaledXLeft(const char *fileName, bool flag) {
-    Coord outSize(imSizeL.x,originalHeightL);
-    RGBImage im = (RGBImage)imNew(IMAGE_RGB, outSize);
+    RGBImage im = (RGBImage)imNew(IMAGE_RGB, fullSizeL);
 
-    RectIterator end=rectEnd(outSize);
-    for(RectIterator p=rectBegin(outSize); p!=end; ++p) {
+    RectIterator end=rectEnd(fullSizeL);
+    for(RectIterator p=rectBegin(fullSizeL); p!=end; ++p) {
         IMREF(im,*p).c[0] = 0; IMREF(im,*p).c[1]=IMREF(im,*p).c[2]=255;
     }
 
@@ -110,14 +227,16 @@ void Match::SaveScaledXLeft(const char *fileName, bool flag) {
 
     end=rectEnd(imSizeL);
     for(RectIterator p=rectBegin(imSizeL); p!=end; ++p) {
-        int d = IMREF(d_left,*p), c;
+        if(! in_roi(*p)) continue;
+        int d = disp(*p), c;
+        Coord q = *p+origin;
         if (d==OCCLUDED) {
-            IMREF(im,*p).c[0]=0; IMREF(im,*p).c[1]=IMREF(im,*p).c[2]=255;
+            IMREF(im,q).c[0]=0; IMREF(im,q).c[1]=IMREF(im,q).c[2]=255;
         } else {
             if (dispSize == 0) c = 255;
             else if (flag) c = 255 - (255-64)*(dispMax - d)/dispSize;
             else           c = 255 - (255-64)*(d - dispMin)/dispSize;
-            IMREF(im,*p).c[0]=IMREF(im,*p).c[1]=IMREF(im,*p).c[2] = c;
+            IMREF(im,q).c[0]=IMREF(im,q).c[1]=IMREF(im,q).c[2] = c;
         }
     }
 
@@ -125,15 +244,123 @@ void Match::SaveScaledXLeft(const char *fileName, bool flag) {
     imFree(im);
 }
 
-/// Specify disparity range
+/// Set receiver of progress messages and its user data.
+void Match::SetLog(LogFunction f, void* data) {
+    logFunction = f;
+    logData = data;
+}
+
+/// Send message to receiver, if any.
+void Match::log(const std::string& message) const {
+    if(logFunction)
+        logFunction(message, logData);
+}
+
+/// Restrict matching to the rectangle of the left image with top-left corner
+/// (x,y) and size w x h, extended by a context \a margin where disparities are
+/// estimated but not output. The right image is restricted to the same rows,
+/// with full width. The cost of KZ2 is proportional to the area of the
+/// extended rectangle. Must be called before SetDispRange and SetParameters.
+void Match::SetROI(int x, int y, int w, int h, int margin) {
+    if(viewImages || imLeftMin) {
+        std::cerr << "Error: SetROI must be called first!" << std::endl;
+        exit(1);
+    }
+    if(x<0 || y<0 || w<=0 || h<=0 || margin<0 ||
+       x+w>imSizeL.x || y+h>imSizeL.y) {
+        std::cerr << "Error: wrong region of interest!" << std::endl;
+        exit(1);
+    }
+    Coord p0(std::max(0,x-margin), std::max(0,y-margin));
+    Coord p1(std::min(imSizeL.x,x+w+margin), std::min(imSizeL.y,y+h+margin));
+    imLeft  = (GeneralImage)imView(imLeft,  p0.x,p0.y, p1.x-p0.x,p1.y-p0.y);
+    imRight = (GeneralImage)imView(imRight, 0,p0.y, imSizeR.x,p1.y-p0.y);
+    viewImages = true;
+    if(!imLeft || !imRight)
+        { std::cerr << "Not enough memory!" << std::endl; exit(1); }
+    imSizeL = Coord(p1.x-p0.x, p1.y-p0.y);
+    imSizeR = Coord(imSizeR.x, p1.y-p0.y);
+    origin = p0;
+    roiMin = Coord(x-p0.x, y-p0.y);
+    roiMax = Coord(roiMin.x+w, roiMin.y+h);
+    dispOffset = p0.x; // Disparity from imLeft to imRight
+
+    imFree(d_left);
+    d_left = (Gray16Image)imNew(IMAGE_GRAY16, imSizeL);
+    alloc_vars();
+    if (!d_left)
+        { std::cerr << "Not enough memory!" << std::endl; exit(1); }
+}
+
+/// Specify disparity range, in original images
 void Match::SetDispRange(int dMin, int dMax) {
-    dispMin = dMin;
-    dispMax = dMax;
+    dispMin = dMin+dispOffset;
+    dispMax = dMax+dispOffset;
     if (! (dispMin<=dispMax) ) {
         std::cerr << "Error: wrong disparity range!\n" << std::endl;
         exit(1);
     }
+    if (dispMax-dispMin >= OCCLUDED_LABEL) {
+        std::cerr << "Error: disparity range too large!\n" << std::endl;
+        exit(1);
+    }
     RectIterator end=rectEnd(imSizeL);
     for(RectIterator p=rectBegin(imSizeL); p!=end; ++p)
-        IMREF(d_left, *p) = OCCLUDED;
+        set_disp(*p, OCCLUDED);
+}
+
+/// Max denominator for fractions. We need to approximate float values as
+/// fractions since the max-flow is implemented using short integers. The
+/// denominator multiplies the data term in Match::data_occlusion_penalty. To
+/// avoid overflow, we have to make sure this stays below 2^15 (max short).
+/// The data term can reach (cutoff<2^5)^2<2^10 if using L2 norm, so a
+/// denominator up to 2^4 will reach 2^14 and not provoke overflow. For 16-bit
+/// images, the data term has 2 more bits and the denominator 2 less, see
+/// Match::GetDenominatorStep.
+static const int MAX_DENOM=1<<4;
+
+/// Store in \a params fractions approximating the last 3 parameters.
+///
+/// They have the same denominator (multiple of \a step up to \c MAX_DENOM),
+/// chosen so that the sum of relative errors is minimized.
+static void set_fractions(Match::Parameters& params,
+                   float K, float lambda1, float lambda2, int step) {
+    float minError = std::numeric_limits<float>::max();
+    for(int i=step; i<=MAX_DENOM; i+=step) {
+        float e = 0;
+        int numK=0, num1=0, num2=0;
+        if(K>0)
+            e += std::abs((numK=int(i*K+.5f))/(i*K) - 1.0f);
+        if(lambda1>0)
+            e += std::abs((num1=int(i*lambda1+.5f))/(i*lambda1) - 1.0f);
+        if(lambda2>0)
+            e += std::abs((num2=int(i*lambda2+.5f))/(i*lambda2) - 1.0f);
+        if(e<minError) {
+            minError = e;
+            params.denominator = i;
+            params.K = numK;
+            params.lambda1 = num1;
+            params.lambda2 = num2;
+        }
+    }
+}
+
+/// Make sure parameters K, lambda1 and lambda2 are non-negative.
+///
+/// - K may be computed automatically and lambda set to K/5.
+/// - lambda1=3*lambda, lambda2=lambda
+/// As the graph requires integer weights, use fractions and common denominator.
+void fix_parameters(Match& m, Match::Parameters& params,
+                    float& K, float& lambda, float& lambda1, float& lambda2,
+                    float kSample) {
+    if(K<0) { // Automatic computation of K
+        m.SetParameters(&params);
+        K = m.GetK(kSample);
+    }
+    if(lambda<0) // Set lambda to K/5
+        lambda = K/5;
+    if(lambda1<0) lambda1 = 3*lambda;
+    if(lambda2<0) lambda2 = lambda;
+    set_fractions(params, K, lambda1, lambda2, m.GetDenominatorStep());
+    m.SetParameters(&params);
 }
@@ -20,20 +20,24 @@
 #define MATCH_H
 
 #include "image.h"
-class Energy;
+#include <string>
+#include <vector>
 
-/// Main class for Kolmogorov-Zabih algorithm
+/// Main class for Kolmogorov-Zabih algorithm.
+/// Instances share no mutable state, so they can run in concurrent threads.
 class Match {
 public:
-    Match(GeneralImage left, GeneralImage right, bool color=false);
+    Match(GeneralImage left, GeneralImage right);
     ~Match();
 
+    void SetROI(int x, int y, int w, int h, int margin);
     void SetDispRange(int dMin, int dMax);
 
     /// Parameters of algorithm.
     struct Parameters
     {
         enum { L1, L2 } dataCost; ///< Data term
+        int cutoff; ///< Upper bound of intensity level difference in data term
         /// Data term must be multiplied by denominator.
         /// Equivalent to using lambda1/denom, lambda2/denom, K/denom
         int denominator;
@@ -46,58 +50,256 @@ public:
 
         int maxIter; ///< Maximum number of iterations
         bool bRandomizeEveryIteration; ///< Random alpha order at each iter
+        bool bInitWTA; ///< Start from winner-take-all disparities
+        bool bFusion;  ///< Fusion moves with proposals before expansions
+        int rangeSize; ///< Labels per range move, 1 for alpha-expansions only
+        int parallelMoves; ///< Concurrent alpha-expansions, 1 for serial
 
     };
-    float GetK();
+    /// Statistics of the last call to KZ2, for benchmarking.
+    struct Stats
+    {
+        int moves;       ///< Number of expansion and fusion moves computed
+        int accepted;    ///< Number of moves that decreased the energy
+        int fusions;     ///< Number of fusion moves that decreased the energy
+        long changes;    ///< Number of pixels changed by accepted moves
+        float iterations;///< Number of moves divided by number of labels
+        long long E;     ///< Final energy
+        double tInit;    ///< Time (s) of winner-take-all and proposals
+        double tBuild;   ///< Time (s) spent building graphs
+        double tMaxflow; ///< Time (s) spent computing max-flows
+        double tUpdate;  ///< Time (s) spent updating the disparity map
+        long growths;       ///< Tree growth steps of max-flows
+        long augmentations; ///< Augmenting paths of max-flows
+        long orphans;       ///< Orphans processed by max-flows
+        long fixed;         ///< Graph nodes fixed before max-flows
+    };
+    float GetK(float fraction=1.0f);
+    void EstimateDispRange(int margin, float outliers);
+    /// Disparity range, in original images
+    int GetDispMin() const { return dispMin-dispOffset; }
+    int GetDispMax() const { return dispMax-dispOffset; }
+    int GetDenominatorStep() const;
     void SetParameters(Parameters *params);
     void KZ2();
+    void KZ2LeftRight(); ///< KZ2 in both directions, concurrently
+    const Stats& GetStats() const { return stats; }
+    void SetGraphDump(const std::string& prefix) { graphDump = prefix; }
+    void SetSeed(unsigned int s) { seed = s; } ///< Seed of random generator
+    /// Full recomputation of the energy, checking its incremental update:
+    /// never, after each iteration, or after each accepted expansion move.
+    enum Verification { VERIFY_OFF, VERIFY_SAMPLED, VERIFY_EVERY };
+    void SetVerification(Verification v) { verification = v; }
+    /// Numbering of graph nodes: pixel after pixel in raster order, or by tiles
+    /// for locality of max-flow computation.
+    enum NodeOrder { ORDER_RASTER, ORDER_TILES };
+    void SetNodeOrder(NodeOrder o) { nodeOrder = o; }
+    /// Fix graph nodes of known value before max-flow, see Graph::reduce.
+    void SetGraphReduction(bool b) { reduceGraphs = b; }
 
-    void SaveXLeft(const char *fileName); ///< Save disp. map as float TIFF
+    /// Receiver of progress messages, given with user \a data. A message may
+    /// be part of a line, a line ends with '\n'.
+    typedef void (*LogFunction)(const std::string& message, void* data);
+    void SetLog(LogFunction f, void* data=0); ///< Null f for no message
+
+    /// Subpixel refinement of disparity maps: fit of data cost around minimum
+    enum SubPixelFit { FIT_NONE, FIT_PARABOLA, FIT_EQUIANGULAR };
+    /// Disp. map as new float image
+    FloatImage GetXLeft(SubPixelFit fit=FIT_NONE) const;
+    /// Right disp. map, after KZ2LeftRight
+    FloatImage GetXRight(SubPixelFit fit=FIT_NONE) const;
+    GrayImage GetConsistency() const; ///< Left-right check, after KZ2LeftRight
+    /// Save disp. map as float TIFF
+    void SaveXLeft(const char *fileName, SubPixelFit fit=FIT_NONE);
     void SaveScaledXLeft(const char *fileName, bool flag); ///< Save colormapped
+    /// Save right disp. map
+    void SaveXRight(const char *fileName, SubPixelFit fit=FIT_NONE);
+    void SaveConsistency(const char *fileName); ///< Save left-right check
 
 private:
     Coord imSizeL, imSizeR; ///< image dimensions
-    int originalHeightL; ///< true left image height before possible crop
-    GrayImage imLeft, imRight;          ///< original images (if gray)
-    RGBImage imColorLeft, imColorRight; ///< original images (if color)
-    GrayImage imLeftMin, imLeftMax;     ///< range of gray based on neighbors
-    GrayImage imRightMin, imRightMax;   ///< range of gray based on neighbors
-    RGBImage imColorLeftMin, imColorLeftMax; ///< For color images
-    RGBImage imColorRightMin, imColorRightMax;
+    Coord fullSizeL, fullSizeR; ///< original dimensions, before crop or ROI
+    Coord origin; ///< position of pixel (0,0) of imLeft in original image
+    Coord roiMin, roiMax; ///< output rectangle [roiMin,roiMax) in imLeft
+    int dispOffset; ///< disparity in original images is disp(p)-dispOffset
+    bool viewImages; ///< are imLeft and imRight views, see SetROI?
+    ImageType imType; ///< Gray or color, 8 or 16 bits per channel
+    GeneralImage imLeft, imRight;       ///< original images
+    GeneralImage imLeftMin, imLeftMax;  ///< range of intensity from neighbors
+    GeneralImage imRightMin, imRightMax;///< range of intensity from neighbors
+    /// Edges to right and bottom neighbors, bits EDGE_X and EDGE_Y
+    GrayImage imLeftEdge, imRightEdge;
+    int costShift; ///< Data cost unit is 1/2^costShift of 8-bit level
     int dispMin, dispMax; ///< range of disparities
 
     static const int OCCLUDED; ///< Special value of disparity meaning occlusion
-    /// If (p,q) is an active assignment
-    /// q == Coord(p.x+IMREF(d_left,p), p.y)
-    IntImage  d_left;
+    /// Label of occlusion in d_left
+    static const unsigned short OCCLUDED_LABEL = 0xffff;
+    /// Disparity labels, d-dispMin or OCCLUDED_LABEL. Use disp and set_disp.
+    /// If (p,q) is an active assignment q == Coord(p.x+disp(p), p.y)
+    Gray16Image d_left;
     Parameters  params; ///< Set of parameters
 
-    int E; ///< Current energy
-    IntImage vars0; ///< Variables before alpha expansion
-    IntImage varsA; ///< Variables after alpha expansion
+    long long E; ///< Current energy
+    Stats stats; ///< Statistics of last run
+    std::string graphDump; ///< If not empty, prefix of files saving graphs
+    unsigned int seed; ///< Seed of alpha order and of sampling in GetK
+    Verification verification; ///< When to recompute the energy
+    NodeOrder nodeOrder; ///< Numbering of graph nodes
+    bool reduceGraphs; ///< Fix nodes of known value before max-flow?
+    Match* reverse; ///< Matcher from right to left image, in left-right mode
+    /// Matchers of concurrent expansion moves, during run, see parallel_moves
+    std::vector<Match*> workers;
+    /// Are the intensity range and edge images those of another?
+    bool sharedSubPixel;
+    LogFunction logFunction; ///< Receiver of progress messages
+    void* logData; ///< User data passed to logFunction
+    /// Variables before/after alpha expansion, by pixel in raster order,
+    /// packed in the index type of the graphs, see pack_vars in kz2.cpp.
+    /// Only the one matching the graphs is allocated, see alloc_vars.
+    std::vector<int> vars;            ///< For Energy
+    std::vector<long long> varsLarge; ///< For LargeEnergy
+    std::vector<int>& packed(int) { return vars; }
+    std::vector<long long>& packed(long long) { return varsLarge; }
+    const std::vector<int>& packed(int) const { return vars; }
+    const std::vector<long long>& packed(long long) const {return varsLarge;}
+    template <class G> typename G::Var& vars_at(Coord p)
+    { return packed(typename G::Var())[(size_t)p.y*imSizeL.x+p.x]; }
+    template <class G> typename G::Var vars_at(Coord p) const
+    { return packed(typename G::Var())[(size_t)p.y*imSizeL.x+p.x]; }
+    /// Change of disparity of a pixel in an expansion move
+    struct Change {
+        Coord p; ///< Pixel
+        int d;   ///< New disparity
+        Change(Coord q, int disp): p(q), d(disp) {}
+    };
+    std::vector<Change> changes; ///< Changes of last accepted expansion move
+
+    int  disp(Coord p) const;
+    void set_disp(Coord p, int d);
+    int  disp(Gray16Image labels, Coord p) const;
+    void set_disp(Gray16Image labels, Coord p, int d);
+
+    struct ReverseTag {};
+    Match(const Match& m, ReverseTag);
+    struct WorkerTag {};
+    Match(const Match& m, WorkerTag);
+    Match(const Match&); // Forbidden
+    Match& operator=(const Match&); // Forbidden
+    void init(GeneralImage left, GeneralImage right);
+    void check_parameters() const;
+    bool in_roi(Coord p) const { return (roiMin<=p && p<roiMax); }
+    Coord node_tile() const;
 
+    void log(const std::string& message) const;
     void run();
+    template <class Im, int Norm> void run();
+    bool large_graphs() const;
+    void alloc_vars();
+    template <class Im, int Norm, class G> void optimize();
+    template <class Im, int Norm, class G>
+    int  sweep(int range, unsigned int& state, Gray16Image proposal);
+    void generate_permutation(unsigned int& state, int *buf, int n) const;
+    static int random_below(unsigned int& state, int n);
     void InitSubPixel();
+    void InitEdges();
 
-    // Data penalty functions
-    int  data_penalty_gray (Coord l, Coord r) const;
-    int  data_penalty_color(Coord l, Coord r) const;
+    // Data penalty functions, specialized for image type and norm
+    template <class Im, int Norm> int data_penalty(Coord l, Coord r) const;
+    template <class Im, int Norm>
+    int  kth_data_penalty(Coord p, int k, int* costs) const;
+    template <class Im, int Norm> float compute_k(float fraction);
+    template <class Im, int Norm>
+    int  window_penalty(Coord p, int d, int radius) const;
+    template <class Im, int Norm>
+    void estimate_disp_range(int margin, float outliers);
+    void subpixel_disparities(FloatImage out, SubPixelFit fit) const;
+    template <class Im, int Norm>
+    void subpixel_disparities(FloatImage out, SubPixelFit fit) const;
+    template <class Im, int Norm>
+    float subpixel_disparity(Coord p, int d, SubPixelFit fit) const;
 
     // Smoothness penalty functions
-    int  smoothness_penalty_gray (Coord p, Coord np, int d) const;
-    int  smoothness_penalty_color(Coord p, Coord np, int d) const;
+    int  smoothness_penalty(Coord p, Coord np, int d) const;
 
     // Kolmogorov-Zabih algorithm
+    template <class Im, int Norm>
     int  data_occlusion_penalty(Coord l, Coord r) const;
-    int  smoothness_penalty(Coord p, Coord np, int d) const;
-    int  ComputeEnergy() const;
-    bool ExpansionMove(int a);
-
-    // Graph construction
-    void build_nodes        (Energy& e, Coord p, int a);
-    void build_smoothness   (Energy& e, Coord p, Coord np, int a);
-    void build_uniqueness(Energy& e, Coord p, int a);
-    void update_disparity(const Energy& e, int a);
+    int  pair_penalty(Coord p1, Coord p2, int d1, int d2) const;
+    template <class Im, int Norm> long long ComputeEnergy() const;
+    int  pair_change(Coord p, Coord q, int d0, int d1, int dq) const;
+    template <class Im, int Norm> void change_disparity(Coord p, int d);
+    template <class Im, int Norm> void verify_energy() const;
+    template <class Im, int Norm>
+    void block_matching(Gray16Image labels, int radius, int dMin, int dMax);
+    template <class Im, int Norm, class G> int fuse_proposals();
+    template <class Im, int Norm, class G>
+    bool FusionMove(Gray16Image proposal);
+    template <class Im, int Norm, class G>
+    bool RangeMove(int a, int b, Gray16Image proposal);
+    template <class Im, int Norm, class G> bool ExpansionMove(int a);
+    template <class Im, int Norm, class G>
+    void parallel_moves(const std::vector<int>& labels,
+                        std::vector<bool>& accepted);
+    bool conflicts(const std::vector<Change>& c, int a,
+                   const std::vector<bool>& near,
+                   const std::vector<bool>& claimed) const;
+
+    // Graph construction, for energies G of 32-bit or 64-bit indices
+    template <class Im, int Norm, class G>
+    void build_nodes(G& e, Coord p, int a);
+    template <class G> void build_smoothness(G& e, Coord p, Coord np, int a);
+    template <class G> void build_uniqueness(G& e, Coord p, int a);
+    template <class G>
+    const std::vector<Change>& extract_changes(const G& e, int a,
+                                               Gray16Image proposal);
+    template <class Im, int Norm, class G>
+    void update_disparity(const G& e, int a, Gray16Image proposal=0);
+
+    // Graph construction of fusion move
+    template <class Im, int Norm>
+    void sanitize_proposal(Gray16Image proposal, IntImage owner, int y);
+    template <class Im, int Norm, class G>
+    void build_fusion_nodes(G& e, Coord p, Gray16Image proposal);
+    template <class G>
+    typename G::Var assignment(Coord p, int d, Gray16Image proposal,
+                               bool& inA0) const;
+    template <class G>
+    void build_fusion_smoothness(G& e, Coord p1, Coord p2,
+                                 Gray16Image proposal);
+    template <class G>
+    void build_fusion_uniqueness(G& e, Coord p, IntImage owner);
 };
 
+void fix_parameters(Match& m, Match::Parameters& params,
+                    float& K, float& lambda, float& lambda1, float& lambda2,
+                    float kSample);
+
+/// Pseudo-random number in [0,n) from linear congruential generator \a state.
+/// Two steps are combined since only the 16 high bits of a step are good.
+inline int Match::random_below(unsigned int& state, int n) {
+    state = state*1103515245u + 12345u;
+    unsigned int r = (state>>16)<<15;
+    state = state*1103515245u + 12345u;
+    return (int)((r ^ (state>>16)) % (unsigned int)n);
+}
+
+/// Disparity at pixel p in map of \a labels, encoded as d_left
+inline int Match::disp(Gray16Image labels, Coord p) const {
+    int l = IMREF(labels, p);
+    return (l==OCCLUDED_LABEL)? OCCLUDED: dispMin+l;
+}
+
+/// Set disparity at pixel p in map of \a labels, encoded as d_left
+inline void Match::set_disp(Gray16Image labels, Coord p, int d) {
+    IMREF(labels, p) = (unsigned short)
+        ((d==OCCLUDED)? OCCLUDED_LABEL: d-dispMin);
+}
+
+/// Disparity at pixel p, OCCLUDED if no active assignment
+inline int Match::disp(Coord p) const { return disp(d_left, p); }
+
+/// Set disparity at pixel p, possibly OCCLUDED
+inline void Match::set_disp(Coord p, int d) { set_disp(d_left, p, d); }
+
 #endif
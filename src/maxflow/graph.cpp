@@ -21,24 +21,30 @@
 
 /// Constructor.
 /// For efficiency, it is advised to give appropriate hint sizes.
-template <typename captype, typename tcaptype, typename flowtype>
-Graph<captype, tcaptype, flowtype>::Graph(int hintNbNodes, int hintNbArcs)
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+Graph<captype,tcaptype,flowtype,idtype>::Graph(node_id hintNbNodes,
+                                               arc_id hintNbArcs)
 : nodes(), arcs(), flow(0), activeBegin(0),activeEnd(0), orphans(), time(0),
   TERMINAL(0), ORPHAN(0)
 {
+    Stats zero = {0, 0, 0, 0};
+    stats = zero;
     nodes.reserve(hintNbNodes);
     arcs.reserve(hintNbArcs);
 }
 
 /// Destructor
-template <typename captype, typename tcaptype, typename flowtype>
-Graph<captype,tcaptype,flowtype>::~Graph()
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+Graph<captype,tcaptype,flowtype,idtype>::~Graph()
 {}
 
 /// Add node to the graph. First call returns 0, second 1, and so on.
-template <typename captype, typename tcaptype, typename flowtype>
-typename Graph<captype,tcaptype,flowtype>::node_id
-Graph<captype,tcaptype,flowtype>::add_node()
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+typename Graph<captype,tcaptype,flowtype,idtype>::node_id
+Graph<captype,tcaptype,flowtype,idtype>::add_node()
 {
     node n = {-1, 0, 0, 0, 0, SOURCE, 0};
     node_id i = static_cast<node_id>(nodes.size());
@@ -47,12 +53,13 @@ Graph<captype,tcaptype,flowtype>::add_node()
 }
 
 /// Add two edges between 'i' and 'j' with the weights 'capij' and 'capji'
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype,tcaptype,flowtype>::add_edge(node_id i, node_id j,
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+void Graph<captype,tcaptype,flowtype,idtype>::add_edge(node_id i, node_id j,
                                                 captype capij, captype capji)
 {
-    assert(0<=i && i<(int)nodes.size());
-    assert(0<=j && j<(int)nodes.size());
+    assert(0<=i && i<(node_id)nodes.size());
+    assert(0<=j && j<(node_id)nodes.size());
     assert(i != j);
     assert(capij >= 0);
     assert(capji >= 0);
@@ -69,8 +76,10 @@ void Graph<captype,tcaptype,flowtype>::add_edge(node_id i, node_id j,
 }
 
 /// Add edge with infinite capacity from node 'i' to 'j'
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype,tcaptype,flowtype>::add_edge_infty(node_id i, node_id j)
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+void Graph<captype,tcaptype,flowtype,idtype>::add_edge_infty(node_id i,
+                                                             node_id j)
 {
     add_edge(i, j, std::numeric_limits<captype>::max(), 0);
 }
@@ -79,12 +88,13 @@ void Graph<captype,tcaptype,flowtype>::add_edge_infty(node_id i, node_id j)
 /// Can be called multiple times for each node.
 /// Weights can be negative.
 /// No internal memory is allocated by this call.
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype,tcaptype,flowtype>::add_tweights(node_id i,
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+void Graph<captype,tcaptype,flowtype,idtype>::add_tweights(node_id i,
                                                     tcaptype capS,
                                                     tcaptype capT)
 {
-    assert(0<=i && i<(int)nodes.size());
+    assert(0<=i && i<(node_id)nodes.size());
     tcaptype delta = nodes[i].cap;
     if(delta > 0) capS += delta;
     else          capT -= delta;
@@ -92,15 +102,180 @@ void Graph<captype,tcaptype,flowtype>::add_tweights(node_id i,
     nodes[i].cap = capS - capT;
 }
 
+/// Can node i be fixed in segment term? See reduce.
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+bool Graph<captype,tcaptype,flowtype,idtype>::fixable(node_id i,
+                                                      termtype& term) const
+{
+    flowtype c = nodes[i].cap, sum=0; // Sum of arc capacities up to |c|
+    term = (c>0)? SOURCE: SINK;
+    if(term==SINK) c = -c+1; // Fix if sum<c, as for SOURCE
+    for(arc_id a=nodes[i].first; a>=0 && sum<c; a=arcs[a].next)
+        if(index[arcs[a].head]>=0)
+            sum += (term==SOURCE)? arcs[a].cap: arcs[arcs[a].sister].cap;
+    return (sum<c);
+}
+
+/// Before maxflow, fix the nodes whose segment is known and remove them.
+///
+/// A node goes to the source if its capacity from the source exceeds the sum of
+/// capacities of its arcs to non-fixed nodes: it is in the source set of any
+/// minimum cut. It goes to the sink if its capacity to the sink is at least
+/// the sum of capacities of arcs from non-fixed nodes: it is outside the
+/// smallest source set, the one maxflow returns. The arcs of a fixed node are
+/// folded into the terminal capacities of its neighbors, which are checked
+/// again. Remaining nodes and arcs are renumbered, keeping their order, and
+/// what_segment translates the original node ids.
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+void Graph<captype,tcaptype,flowtype,idtype>::reduce()
+{
+    assert(!TERMINAL && index.empty());
+    const node_id n = static_cast<node_id>(nodes.size());
+    index.assign(n, 0);
+    std::vector<node_id> stack; // Nodes to check again
+    long fixed=0;
+    for(node_id i0=0; i0<n; i0++) {
+        stack.push_back(i0);
+        while(! stack.empty()) {
+            node_id i = stack.back();
+            stack.pop_back();
+            termtype term;
+            if(index[i]<0 || !fixable(i,term)) continue;
+            index[i] = -1-term;
+            ++fixed;
+            for(arc_id a=nodes[i].first; a>=0; a=arcs[a].next) {
+                node_id j = arcs[a].head;
+                if(index[j]<0) continue;
+                if(term==SOURCE) add_tweights(j, arcs[a].cap, 0);
+                else             add_tweights(j, 0, arcs[arcs[a].sister].cap);
+                if(j<=i0) // Not checked later in the loop
+                    stack.push_back(j);
+            }
+        }
+    }
+
+    // Compact nodes, then arcs by pairs, relinking them in the same order
+    node_id m=0;
+    for(node_id i=0; i<n; i++)
+        if(index[i]>=0) {
+            index[i] = m;
+            nodes[m] = nodes[i];
+            nodes[m++].first = -1;
+        }
+    nodes.resize(m);
+    arc_id k=0;
+    for(arc_id a=0; a<static_cast<arc_id>(arcs.size()); a+=2) {
+        node_id i=index[arcs[a+1].head], j=index[arcs[a].head];
+        if(i<0 || j<0) continue;
+        arc aij = {j, nodes[i].first, k+1, arcs[a].cap};
+        arc aji = {i, nodes[j].first, k, arcs[a+1].cap};
+        nodes[i].first = k;
+        nodes[j].first = k+1;
+        arcs[k++] = aij;
+        arcs[k++] = aji;
+    }
+    arcs.resize(k);
+    stats.fixed = fixed;
+}
+
 /// After the maxflow is computed, this function returns to which segment the
 /// node 'i' belongs (SOURCE or SINK).
 /// Occasionally there may be several minimum cuts. If a node can be assigned
 /// to both the source and the sink, then default def is returned.
-template <typename captype, typename tcaptype, typename flowtype>
-typename Graph<captype,tcaptype,flowtype>::termtype
-Graph<captype,tcaptype,flowtype>::what_segment(node_id i, termtype def) const
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+typename Graph<captype,tcaptype,flowtype,idtype>::termtype
+Graph<captype,tcaptype,flowtype,idtype>::what_segment(node_id i,
+                                                      termtype def) const
 {
+    if(! index.empty()) { // Reduced graph
+        i = index[i];
+        if(i<0) return static_cast<termtype>(-1-i);
+    }
     return (nodes[i].parent? nodes[i].term: def);
 }
 
+/// Header of graph file: magic number and sizes of types, to detect mismatch
+static const char GRAPH_FILE_MAGIC[4] = {'K','Z','2','G'};
+
+/// Save graph before maxflow in binary file: header, number of nodes, number
+/// of edges (both of index type), flow from terminal weights, node capacities,
+/// then each edge (i,j,capij,capji) in order of creation. Return whether it
+/// succeeded.
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+bool Graph<captype,tcaptype,flowtype,idtype>::save(const char* fileName) const
+{
+    assert(!TERMINAL); // Residual graph after maxflow cannot be saved
+    FILE* f = fopen(fileName, "wb");
+    if(!f) return false;
+    unsigned char sizes[4] = { sizeof(node_id), sizeof(captype),
+                               sizeof(tcaptype), sizeof(flowtype) };
+    node_id nNodes = static_cast<node_id>(nodes.size());
+    arc_id nEdges = static_cast<arc_id>(arcs.size()/2);
+    bool ok = (fwrite(GRAPH_FILE_MAGIC, 1, 4, f) == 4 &&
+               fwrite(sizes, 1, 4, f) == 4 &&
+               fwrite(&nNodes, sizeof(node_id), 1, f) == 1 &&
+               fwrite(&nEdges, sizeof(arc_id), 1, f) == 1 &&
+               fwrite(&flow, sizeof(flowtype), 1, f) == 1);
+    for(node_id i=0; ok && i<nNodes; i++)
+        ok = (fwrite(&nodes[i].cap, sizeof(tcaptype), 1, f) == 1);
+    for(arc_id e=0; ok && e<nEdges; e++) {
+        const arc& a=arcs[2*e], &b=arcs[2*e+1];
+        ok = (fwrite(&b.head, sizeof(node_id), 1, f) == 1 &&
+              fwrite(&a.head, sizeof(node_id), 1, f) == 1 &&
+              fwrite(&a.cap, sizeof(captype), 1, f) == 1 &&
+              fwrite(&b.cap, sizeof(captype), 1, f) == 1);
+    }
+    return (fclose(f)==0 && ok);
+}
+
+/// Load graph saved by \c save, appending its nodes and edges. The graph must
+/// be empty. Return whether it succeeded.
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+bool Graph<captype,tcaptype,flowtype,idtype>::load(const char* fileName)
+{
+    assert(nodes.empty() && arcs.empty());
+    FILE* f = fopen(fileName, "rb");
+    if(!f) return false;
+    char magic[4];
+    unsigned char sizes[4];
+    node_id nNodes=0;
+    arc_id nEdges=0;
+    bool ok = (fread(magic, 1, 4, f) == 4 &&
+               memcmp(magic, GRAPH_FILE_MAGIC, 4) == 0 &&
+               fread(sizes, 1, 4, f) == 4 &&
+               sizes[0] == sizeof(node_id) && sizes[1] == sizeof(captype) &&
+               sizes[2] == sizeof(tcaptype) && sizes[3] == sizeof(flowtype) &&
+               fread(&nNodes, sizeof(node_id), 1, f) == 1 &&
+               fread(&nEdges, sizeof(arc_id), 1, f) == 1 &&
+               nNodes >= 0 && nEdges >= 0 &&
+               fread(&flow, sizeof(flowtype), 1, f) == 1);
+    if(ok) {
+        nodes.reserve(nNodes);
+        arcs.reserve(2*nEdges+2); // 2 for fictive arcs of maxflow
+    }
+    for(node_id i=0; ok && i<nNodes; i++) {
+        node_id n = add_node();
+        ok = (fread(&nodes[n].cap, sizeof(tcaptype), 1, f) == 1);
+    }
+    for(arc_id e=0; ok && e<nEdges; e++) {
+        node_id i, j;
+        captype capij, capji;
+        ok = (fread(&i, sizeof(node_id), 1, f) == 1 &&
+              fread(&j, sizeof(node_id), 1, f) == 1 &&
+              fread(&capij, sizeof(captype), 1, f) == 1 &&
+              fread(&capji, sizeof(captype), 1, f) == 1 &&
+              0<=i && i<nNodes && 0<=j && j<nNodes && i!=j &&
+              capij>=0 && capji>=0);
+        if(ok)
+            add_edge(i, j, capij, capji);
+    }
+    fclose(f);
+    return ok;
+}
+
 #endif
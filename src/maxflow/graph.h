@@ -21,6 +21,7 @@
 
 #include <string.h>
 #include <assert.h>
+#include <stdio.h>
 #include <vector>
 #include <queue>
 #include <limits>
@@ -45,14 +46,24 @@
 /// captype: type of edge capacities (excluding t-links)
 /// tcaptype: type of t-links (edges between nodes and terminals)
 /// flowtype: type of total flow
-template <typename captype, typename tcaptype, typename flowtype> class Graph
+/// idtype: signed type of node and arc indices
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype=int> class Graph
 {
 public:
     typedef enum { SOURCE=0, SINK=1} termtype; ///< terminals 
-    typedef int node_id;
-    typedef int arc_id;
+    typedef idtype node_id;
+    typedef idtype arc_id;
+
+    /// Counters of the last maxflow computation
+    struct Stats {
+        long growths;       ///< Tree growth steps (active nodes processed)
+        long augmentations; ///< Augmenting paths
+        long orphans;       ///< Orphans processed for adoption
+        long fixed;         ///< Nodes fixed by reduce
+    };
 
-    Graph(int hintNbNodes=0, int hintNbArcs=0);
+    Graph(node_id hintNbNodes=0, arc_id hintNbArcs=0);
     virtual ~Graph();
 
     node_id add_node();
@@ -60,8 +71,13 @@ public:
     void add_edge_infty(node_id i, node_id j);
     void add_tweights(node_id i, tcaptype capS, tcaptype capT);
 
+    void reduce();
     flowtype maxflow();
     termtype what_segment(node_id i, termtype defaultSegm=SOURCE) const;
+    const Stats& get_stats() const { return stats; }
+
+    bool save(const char* fileName) const;
+    bool load(const char* fileName);
 
 private:
     struct node;
@@ -87,11 +103,15 @@ private:
 
     std::vector<node> nodes; ///< All nodes of graph
     std::vector<arc> arcs;   ///< All arcs of graph
+    /// After reduce, index of each node in reduced graph, or -1-term for a
+    /// node fixed in segment term. Empty if not reduced.
+    std::vector<node_id> index;
 
     flowtype flow; ///< total flow
     node *activeBegin, *activeEnd; ///< list of active nodes
     std::queue<node*> orphans; ///< list of pointers to orphans
     int time; ///< monotonically increasing global counter
+    Stats stats; ///< counters of maxflow
 
     // special constants for node.parent
     arc* TERMINAL; ///< arc to terminal
@@ -106,6 +126,7 @@ private:
     void process_orphan(node* i);
     void adopt_orphans();
 
+    bool fixable(node_id i, termtype& term) const;
     void maxflow_init();
     int dist_to_root(node* j);
     arc* grow_tree(node* i);
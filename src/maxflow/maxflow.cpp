@@ -24,8 +24,9 @@
 /// Mark node as active.
 /// i->next points to the next active node (or itself, if last).
 /// i->next is 0 iff i should not be considered in the queue.
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype,tcaptype,flowtype>::set_active(node* i)
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+void Graph<captype,tcaptype,flowtype,idtype>::set_active(node* i)
 {
     if (!i->next) { // not yet in the list
         i->next = i;
@@ -42,9 +43,10 @@ void Graph<captype,tcaptype,flowtype>::set_active(node* i)
 /// later appear to be orphan too. To avoid having to remove them explicitly
 /// we just have their parent set to null, so when the front node in the
 /// queue has a null parent, we just ignore it.
-template <typename captype, typename tcaptype, typename flowtype>
-typename Graph<captype,tcaptype,flowtype>::node*
-Graph<captype,tcaptype,flowtype>::next_active()
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+typename Graph<captype,tcaptype,flowtype,idtype>::node*
+Graph<captype,tcaptype,flowtype,idtype>::next_active()
 {
     node* i;
     while((i=activeBegin) != 0) {
@@ -58,16 +60,18 @@ Graph<captype,tcaptype,flowtype>::next_active()
 }
 
 /// Set node as orphan.
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype,tcaptype,flowtype>::set_orphan(node* i)
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+void Graph<captype,tcaptype,flowtype,idtype>::set_orphan(node* i)
 {
     i->parent = ORPHAN;
     orphans.push(i);
 }
 
 /// Set active nodes at distance 1 from a terminal node.
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype,tcaptype,flowtype>::maxflow_init()
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+void Graph<captype,tcaptype,flowtype,idtype>::maxflow_init()
 {
     // Put two fictive arcs
     arc a = {-1,-1,-1,0};
@@ -78,6 +82,7 @@ void Graph<captype,tcaptype,flowtype>::maxflow_init()
 
     activeBegin=activeEnd=0;
     time = 0;
+    stats.growths = stats.augmentations = stats.orphans = 0;
 
     typename std::vector<node>::iterator i=nodes.begin();
     for (; i!=nodes.end(); ++i) {
@@ -96,9 +101,10 @@ void Graph<captype,tcaptype,flowtype>::maxflow_init()
 
 /// Extend the tree to neighbor nodes of tree leaf i. If doing so reaches the
 /// other tree, return the arc oriented from source tree to sink tree.
-template <typename captype, typename tcaptype, typename flowtype>
-typename Graph<captype,tcaptype,flowtype>::arc*
-Graph<captype,tcaptype,flowtype>::grow_tree(node* i)
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+typename Graph<captype,tcaptype,flowtype,idtype>::arc*
+Graph<captype,tcaptype,flowtype,idtype>::grow_tree(node* i)
 {
     for (arc_id a=i->first; a>=0; a=arcs[a].next)
         if (i->term==SOURCE? arcs[a].cap: arcs[arcs[a].sister].cap) {
@@ -117,8 +123,9 @@ Graph<captype,tcaptype,flowtype>::grow_tree(node* i)
 
 /// Find max flow that we can push from source to sink through midarc.
 /// midarc must be oriented from source tree to sink tree.
-template <typename captype, typename tcaptype, typename flowtype>
-captype Graph<captype,tcaptype,flowtype>::find_bottleneck(arc* midarc)
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+captype Graph<captype,tcaptype,flowtype,idtype>::find_bottleneck(arc* midarc)
 {
     captype cap = midarc->cap;
 
@@ -147,8 +154,9 @@ captype Graph<captype,tcaptype,flowtype>::find_bottleneck(arc* midarc)
 }
 
 /// Push flow f through path from source to sink through midarc.
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype,tcaptype,flowtype>::push_flow(arc* midarc, captype f)
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+void Graph<captype,tcaptype,flowtype,idtype>::push_flow(arc* midarc, captype f)
 {
     flow += f;
     arcs[midarc->sister].cap += f;
@@ -183,8 +191,9 @@ void Graph<captype,tcaptype,flowtype>::push_flow(arc* midarc, captype f)
 }
 
 /// Push flow through path from source to sink passing through midarc.
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype,tcaptype,flowtype>::augment(arc* midarc)
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+void Graph<captype,tcaptype,flowtype,idtype>::augment(arc* midarc)
 {
     // Orient arc from source tree to sink tree
     if(nodes[midarc->head].term==SOURCE)
@@ -192,12 +201,14 @@ void Graph<captype,tcaptype,flowtype>::augment(arc* midarc)
 
     captype bottleneck = find_bottleneck(midarc);
     push_flow(midarc, bottleneck);
+    ++stats.augmentations;
 }
 
 /// Number of nodes of path from the root of the tree to node j.
 /// Return max integer in case there is no path.
-template <typename captype, typename tcaptype, typename flowtype>
-int Graph<captype,tcaptype,flowtype>::dist_to_root(node* j)
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+int Graph<captype,tcaptype,flowtype,idtype>::dist_to_root(node* j)
 {
     int d = 2; // count nodes j and root
     for(arc* a; (a=j->parent)!=TERMINAL; d++, j=&nodes[a->head]) {
@@ -212,8 +223,9 @@ int Graph<captype,tcaptype,flowtype>::dist_to_root(node* j)
 }
 
 /// Try to reconnect orphan to its original tree.
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype,tcaptype,flowtype>::process_orphan(node* i)
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+void Graph<captype,tcaptype,flowtype,idtype>::process_orphan(node* i)
 {
     int dmin=std::numeric_limits<int>::max();
 
@@ -253,23 +265,27 @@ void Graph<captype,tcaptype,flowtype>::process_orphan(node* i)
 }
 
 /// Try reconnecting orphans to their tree
-template <typename captype, typename tcaptype, typename flowtype>
-void Graph<captype,tcaptype,flowtype>::adopt_orphans()
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+void Graph<captype,tcaptype,flowtype,idtype>::adopt_orphans()
 {
     while(! orphans.empty()) {
         node* i = orphans.front();
         orphans.pop();
         process_orphan(i);
+        ++stats.orphans;
     }
 }
 
 /// Compute the maxflow.
-template <typename captype, typename tcaptype, typename flowtype>
-flowtype Graph<captype,tcaptype,flowtype>::maxflow()
+template <typename captype, typename tcaptype, typename flowtype,
+          typename idtype>
+flowtype Graph<captype,tcaptype,flowtype,idtype>::maxflow()
 {
     maxflow_init();
     for(node *i=0; i || (i=next_active());) {
         arc* a = grow_tree(i);
+        ++stats.growths;
         ++time;
         if(!a) {
             i = 0;
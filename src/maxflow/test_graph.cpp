@@ -0,0 +1,224 @@
+/**
+ * @file test_graph.cpp
+ * @brief Test of max-flow with and without reduction, and of graph files
+ * @author Pascal Monasse <monasse@imagine.enpc.fr>
+ *
+ * Copyright (c) 2026, Pascal Monasse
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Pulic License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "graph.h"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+/// Same types as Energy and LargeEnergy
+typedef Graph<short,short,long long,int> Graph3;
+typedef Graph<short,short,long long,long long> Graph3L;
+
+static int errors=0; ///< Number of failed checks
+
+/// Record failure of check \a ok, described by \a what
+static void check(bool ok, const char* what) {
+    if(! ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++errors;
+    }
+}
+
+/// Small graph kept as lists of terminal weights and edges, to build it in
+/// several graphs and to compute its minimum cut by brute force.
+struct Net {
+    struct Edge { int i, j; short capij, capji; };
+    std::vector<short> capS, capT; ///< Terminal weights of nodes
+    std::vector<Edge> edges;
+
+    int add_node(short s, short t) {
+        capS.push_back(s); capT.push_back(t);
+        return (int)capS.size()-1;
+    }
+    void add_edge(int i, int j, short capij, short capji) {
+        Edge e = {i, j, capij, capji};
+        edges.push_back(e);
+    }
+    template <class G> void build(G& g) const {
+        for(size_t i=0; i<capS.size(); i++)
+            g.add_tweights(g.add_node(), capS[i], capT[i]);
+        for(size_t k=0; k<edges.size(); k++)
+            g.add_edge(edges[k].i, edges[k].j, edges[k].capij, edges[k].capji);
+    }
+    /// Minimum over all cuts, bit i of a cut meaning node i in sink set
+    long long min_cut() const {
+        const int n = (int)capS.size();
+        long long best=-1;
+        for(long cut=0; cut < (1L<<n); cut++) {
+            long long c=0;
+            for(int i=0; i<n; i++)
+                c += ((cut>>i)&1)? capS[i]: capT[i];
+            for(size_t k=0; k<edges.size(); k++) {
+                bool ti=(cut>>edges[k].i)&1, tj=(cut>>edges[k].j)&1;
+                if(!ti && tj) c += edges[k].capij;
+                if(ti && !tj) c += edges[k].capji;
+            }
+            if(best<0 || c<best) best = c;
+        }
+        return best;
+    }
+};
+
+/// Compare maxflow of \a net with and without reduction: same flow, equal to
+/// the minimum cut, and same segments. Return the number of fixed nodes.
+template <class G>
+static long compare_reduce(const Net& net) {
+    G g, h;
+    net.build(g);
+    net.build(h);
+    h.reduce();
+    long long flow=g.maxflow(), flowReduced=h.maxflow();
+    check(flow==net.min_cut(), "flow is minimum cut");
+    check(flow==flowReduced, "same flow with reduce");
+    // Ties are in the sink set for both, see Graph::reduce
+    for(int i=0; i<(int)net.capS.size(); i++)
+        check(g.what_segment(i,G::SINK)==h.what_segment(i,G::SINK),
+              "same segment with reduce");
+    return h.get_stats().fixed;
+}
+
+/// Chain of nodes fixed to the sink (0 then 1), to the source (5, then 4
+/// checked again after its neighbor), around nodes 2 and 3 that are not.
+template <class G>
+static void test_reduce_chains() {
+    Net net;
+    net.add_node(0, 10); net.add_node(0, 1); net.add_node(5, 0);
+    net.add_node(0, 5);  net.add_node(1, 0); net.add_node(10, 0);
+    net.add_edge(0, 1, 2, 2);
+    net.add_edge(1, 2, 3, 3);
+    net.add_edge(2, 3, 4, 4);
+    net.add_edge(4, 3, 2, 2);
+    net.add_edge(5, 4, 3, 3);
+    check(compare_reduce<G>(net)==4, "fixed nodes of chains");
+    G g;
+    net.build(g);
+    g.reduce();
+    g.maxflow();
+    check(g.what_segment(0)==G::SINK && g.what_segment(1)==G::SINK,
+          "sink chain");
+    check(g.what_segment(4)==G::SOURCE && g.what_segment(5)==G::SOURCE,
+          "source chain");
+}
+
+/// Pseudo-random graphs of \a n nodes, with strong terminal weights at some
+/// nodes so that reduce fixes them, and with nodes it cannot fix.
+template <class G>
+static void test_reduce_random(int n, int count) {
+    unsigned long state=1;
+    long fixed=0;
+    for(int k=0; k<count; k++) {
+        Net net;
+        for(int i=0; i<n; i++) {
+            state = state*1103515245+12345;
+            short w = (short)((state>>16)%20);
+            bool strong = ((state>>8)%3==0), toSource = ((state>>12)&1);
+            if(strong) w = (short)(w+30);
+            net.add_node(toSource? w: 0, toSource? 0: w);
+        }
+        for(int i=0; i<n; i++)
+            for(int j=i+1; j<n; j++) {
+                state = state*1103515245+12345;
+                if((state>>16)%3) continue;
+                net.add_edge(i, j, (short)((state>>8)%10),
+                             (short)((state>>20)%10));
+            }
+        fixed += compare_reduce<G>(net);
+    }
+    check(fixed>0, "reduce fixes nodes of random graphs");
+}
+
+/// Content of file \a name, empty if it cannot be read
+static std::string read_file(const char* name) {
+    std::ifstream f(name, std::ifstream::binary);
+    return std::string(std::istreambuf_iterator<char>(f),
+                       std::istreambuf_iterator<char>());
+}
+
+/// Write \a content to file \a name
+static void write_file(const char* name, const std::string& content) {
+    std::ofstream f(name, std::ofstream::binary);
+    f.write(content.data(), (std::streamsize)content.size());
+}
+
+/// Save a graph of type \a G and load it back: saving the loaded graph must
+/// give the same file, so the same nodes, arcs and flow, and the maxflow and
+/// segments must be the same. A graph of type \a Other, of the other index
+/// size, must refuse the file, as must \a G for a bad or truncated header.
+template <class G, class Other>
+static void test_save_load(const char* name) {
+    Net net;
+    net.add_node(3, 7); net.add_node(9, 2); net.add_node(0, 4);
+    net.add_node(6, 6); net.add_node(1, 0);
+    net.add_edge(0, 1, 2, 5);
+    net.add_edge(1, 2, 4, 1);
+    net.add_edge(2, 3, 3, 3);
+    net.add_edge(3, 0, 0, 8);
+    net.add_edge(4, 1, 6, 2);
+    G g;
+    net.build(g);
+    check(g.save(name), "save graph");
+    const std::string file = read_file(name);
+
+    G h;
+    check(h.load(name), "load graph");
+    const std::string copy = std::string(name)+".copy";
+    check(h.save(copy.c_str()) && read_file(copy.c_str())==file,
+          "same file after loading");
+    std::remove(copy.c_str());
+    long long flow = h.maxflow();
+    check(flow==g.maxflow() && flow==net.min_cut(), "same flow after loading");
+    for(int i=0; i<(int)net.capS.size(); i++)
+        check(g.what_segment(i)==h.what_segment(i),
+              "same segment after loading");
+
+    Other other;
+    check(! other.load(name), "reject other index size");
+    std::string bad = file;
+    bad[0] = 'X'; // Magic number
+    write_file(name, bad);
+    G g1;
+    check(! g1.load(name), "reject bad magic number");
+    bad = file;
+    bad[7] = (char)(bad[7]+1); // Size of flow type
+    write_file(name, bad);
+    G g2;
+    check(! g2.load(name), "reject bad type size");
+    write_file(name, file.substr(0, file.size()-1));
+    G g3;
+    check(! g3.load(name), "reject truncated file");
+    std::remove(name);
+    G g4;
+    check(! g4.load(name), "reject missing file");
+}
+
+int main() {
+    test_reduce_chains<Graph3>();
+    test_reduce_chains<Graph3L>();
+    test_reduce_random<Graph3>(10, 200);
+    test_reduce_random<Graph3L>(10, 50);
+    test_save_load<Graph3,Graph3L>("test_graph32.graph");
+    test_save_load<Graph3L,Graph3>("test_graph64.graph");
+    if(errors)
+        std::cerr << errors << " failed checks" << std::endl;
+    else
+        std::cout << "All graph checks passed" << std::endl;
+    return errors? 1: 0;
+}
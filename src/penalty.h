@@ -0,0 +1,104 @@
+/**
+ * @file penalty.h
+ * @brief Data and smoothness penalties, specialized for image type and norm
+ * @author Vladimir Kolmogorov <vnk@cs.cornell.edu>
+ *         Pascal Monasse <monasse@imagine.enpc.fr>
+ *
+ * Copyright (c) 2001-2003, 2012-2014, 2026, Vladimir Kolmogorov, Pascal Monasse
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Pulic License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PENALTY_H
+#define PENALTY_H
+
+#include "match.h"
+#include <algorithm>
+#include <cassert>
+
+/// Call the member function template f<Im,Norm> with arguments args, a
+/// parenthesized list, for the image type and data norm of the matcher, and
+/// return its result. Used once per run, so that the penalties are inlined.
+#define KERNEL_DISPATCH(f, args)                                    \
+    switch(imType) {                                                \
+    case IMAGE_GRAY:   KERNEL_DISPATCH_NORM(f, GrayImage,   args);  \
+    case IMAGE_RGB:    KERNEL_DISPATCH_NORM(f, RGBImage,    args);  \
+    case IMAGE_GRAY16: KERNEL_DISPATCH_NORM(f, Gray16Image, args);  \
+    case IMAGE_RGB16:  KERNEL_DISPATCH_NORM(f, RGB16Image,  args);  \
+    default: assert(false); break;                                  \
+    }
+#define KERNEL_DISPATCH_NORM(f, Im, args)                           \
+    return (params.dataCost==Parameters::L1)?                       \
+        f<Im,Parameters::L1> args: f<Im,Parameters::L2> args
+
+/************************************************************/
+/********************* data penalty *************************/
+/************************************************************/
+// The data term is computed as described in
+//   Stan Birchfield and Carlo Tomasi
+//   "A pixel dissimilarity measure that is insensitive to image sampling"
+//   IEEE Trans. on PAMI 20(4):401-406, April 98
+// with one distinction: intensity intervals for a pixels
+// are computed from 4 neighbors rather than 2.
+
+/// Distance from v to interval [min,max]
+inline int dist_interval(int v, int min, int max) {
+    if(v<min) return (min-v);
+    if(v>max) return (v-max);
+    return 0;
+}
+
+/// Birchfield-Tomasi distance between pixels p and q.
+///
+/// Intensity differences are expressed in 1/2^costShift of 8-bit level before
+/// applying the cutoff and the norm.
+template <class Im, int Norm>
+inline int Match::data_penalty(Coord p, Coord q) const {
+    typedef PixelTraits<Im> P;
+    const int shift = P::bits-8-costShift; // From channel value to cost unit
+    const int cutoff = params.cutoff<<costShift;
+    int dSum=0;
+    // Loop over the channels
+    for(int i=0; i<P::channels; i++) {
+        int Ip    = P::at((Im)imLeft,     p, i);
+        int Iq    = P::at((Im)imRight,    q, i);
+        int IpMin = P::at((Im)imLeftMin,  p, i);
+        int IqMin = P::at((Im)imRightMin, q, i);
+        int IpMax = P::at((Im)imLeftMax,  p, i);
+        int IqMax = P::at((Im)imRightMax, q, i);
+
+        int dp = dist_interval(Ip, IqMin, IqMax);
+        int dq = dist_interval(Iq, IpMin, IpMax);
+        int d = std::min(dp, dq) >> shift;
+        if(d>cutoff) d = cutoff;
+        if(Norm==Parameters::L2) d = (d*d) >> costShift;
+        dSum += d;
+    }
+    return dSum/P::channels;
+}
+
+/************************************************************/
+/****************** smoothness penalty **********************/
+/************************************************************/
+
+/// Bits of the edge images: intensity difference with the right and bottom
+/// neighbors at least the edge threshold, in some channel.
+enum { EDGE_X=1, EDGE_Y=2 };
+
+/// Smoothness penalty between assignments (p1,p1+disp) and (p2,p2+disp), with
+/// p1 and p2 neighbors. There is an edge if there is one in either image.
+inline int Match::smoothness_penalty(Coord p1, Coord p2, int disp) const {
+    const int bit = (p1.y==p2.y)? EDGE_X: EDGE_Y;
+    Coord p = (p1.x+p1.y < p2.x+p2.y)? p1: p2; // Left or top pixel
+    int edges = IMREF(imLeftEdge, p) | IMREF(imRightEdge, p+disp);
+    return (edges & bit)? params.lambda2: params.lambda1;
+}
+
+#endif
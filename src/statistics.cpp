@@ -1,6 +1,6 @@
 /**
  * @file statistics.cpp
- * @brief Automatic computation of K in Kolmogorov-Zabih algorithm
+ * @brief Automatic computation of K and of the disparity range
  * @author Vladimir Kolmogorov <vnk@cs.cornell.edu>
  *         Pascal Monasse <monasse@imagine.enpc.fr>
  *
@@ -17,45 +17,225 @@
  */
 
 #include <algorithm>
+#include <vector>
 #include <iostream>
-#include "match.h"
+#include <sstream>
+#include <cmath>
+#include <cstdlib>
+#include "penalty.h"
+
+/// Number of rows in a stratum of GetK sampling
+static const int STRATUM_ROWS=16;
+/// Minimum number of samples per stratum, for variance estimation
+static const int STRATUM_MIN_SAMPLES=2;
+
+/// Distance in pixels between samples of EstimateDispRange, in x and y
+static const int SPARSE_STEP=8;
+/// Half-size of windows of sparse matches
+static const int SPARSE_RADIUS=3;
+/// Maximum ratio of the lowest window cost of a sparse match to the lowest
+/// one at other disparities, for distinctiveness
+static const float SPARSE_RATIO=0.8f;
+/// Minimum number of sparse matches to restrict the disparity range
+static const int SPARSE_MIN_MATCHES=16;
+
+/// k'th smallest value among data_penalty(p, p+d) for all d.
+///
+/// \a costs is a buffer of size dispMax-dispMin+1.
+template <class Im, int Norm>
+inline int Match::kth_data_penalty(Coord p, int k, int* costs) const {
+    const int n = dispMax-dispMin+1;
+    for(int d=dispMin; d<=dispMax; d++)
+        costs[d-dispMin] = data_penalty<Im,Norm>(p,p+d);
+    if(k>n) k=n;
+    std::nth_element(costs, costs+k-1, costs+n);
+    return costs[k-1];
+}
 
 /// Heuristic for selecting parameter 'K'
 /// Details are described in Kolmogorov's thesis
-float Match::GetK()
+///
+/// If \a fraction<1, K is estimated from this fraction of pixels, drawn at
+/// random in horizontal bands of STRATUM_ROWS rows (stratified sampling), and
+/// a 95% confidence interval is displayed. The sample depends on the seed.
+float Match::GetK(float fraction)
+{
+    KERNEL_DISPATCH(compute_k, (fraction));
+    return 0;
+}
+
+/// Estimation of K, see GetK.
+template <class Im, int Norm>
+float Match::compute_k(float fraction)
 {
     int i = dispMax-dispMin+1;
     int k = (i+2)/4; // around 0.25 times the number of disparities
     if(k<3) k=3;
 
-    int* array = new int[k];
-    std::fill_n(array, k, 0);
-    int sum=0, num=0;
-
     int xmin = std::max(0,-dispMin); // 0<=x,x+dispMin
     int xmax = std::min(imSizeL.x,imSizeR.x-dispMax); // x<wl,x+dispMax<wr
-    Coord p;
-    for(p.y=0; p.y<imSizeL.y && p.y<imSizeR.y; p.y++)
-    for(p.x=xmin; p.x<xmax; p.x++) {
-        // compute k'th smallest value among data_penalty(p, p+d) for all d
-        for(int i=0, d=dispMin; d<=dispMax; d++) {
-            int delta = (imLeft?
-                         data_penalty_gray (p,p+d):
-                         data_penalty_color(p,p+d));
-            if(i<k) array[i++] = delta;
-            else for(i=0; i<k; i++)
-                     if(delta<array[i])
-                         std::swap(delta, array[i]);
+    int ymax = std::min(imSizeL.y,imSizeR.y);
+    const int width = std::max(0, xmax-xmin);
+    const int strata = (ymax+STRATUM_ROWS-1)/STRATUM_ROWS;
+    const bool sample = (fraction<1.0f);
+
+    // Sums over pixels, or stratified estimate and its variance if sampling
+    double sum=0, var=0;
+    int num=0;
+#ifdef _OPENMP
+#pragma omp parallel reduction(+:sum,var,num)
+#endif
+    {
+        std::vector<int> costs(i);
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for(int h=0; h<strata; h++) {
+            const int y0=h*STRATUM_ROWS, y1=std::min(ymax,y0+STRATUM_ROWS);
+            const int size = width*(y1-y0); // Pixels in stratum
+            if(size==0) continue;
+            if(! sample) {
+                Coord p;
+                for(p.y=y0; p.y<y1; p.y++)
+                    for(p.x=xmin; p.x<xmax; p.x++)
+                        sum += kth_data_penalty<Im,Norm>(p, k, &costs[0]);
+                num += size;
+                continue;
+            }
+            int n = std::max(STRATUM_MIN_SAMPLES, (int)(fraction*size+.5f));
+            unsigned int state = seed ^ ((unsigned int)h*2654435761u);
+            double s=0, s2=0;
+            for(int j=0; j<n; j++) {
+                int r = random_below(state, size);
+                Coord p(xmin+r%width, y0+r/width);
+                double v = kth_data_penalty<Im,Norm>(p, k, &costs[0]);
+                s += v; s2 += v*v;
+            }
+            double mean = s/n, varh = (s2-n*mean*mean)/(n-1);
+            sum += size*mean; // Weighted by stratum size
+            var += (double)size*size*varh/n;
+            num += n;
         }
-        sum += *std::max_element(array, array+k);
-        num ++;
     }
 
-    delete [] array;
     if(num==0) { std::cerr<<"GetK: Not enough samples!"<<std::endl; exit(1); }
     if(sum==0) { std::cerr<<"GetK failed: K is 0!"<<std::endl; exit(1); }
 
-    float K = ((float)sum)/num;
-    std::cout <<"Computing statistics: K(data_penalty noise) ="<< K <<std::endl;
+    const double scale = 1.0/GetDenominatorStep(); // K in 8-bit levels
+    const double total = (double)width*ymax; // Pixels in sampled region
+    float K = (float)((sample? sum/total: sum/num)*scale);
+    std::ostringstream str;
+    str << "Computing statistics: K(data_penalty noise) =" << K;
+    if(sample)
+        str << " +/- " << 1.96*std::sqrt(var)/total*scale
+            << " (95% confidence, " << num << " samples)";
+    str << '\n';
+    log(str.str());
     return K;
 }
+
+/// Sum of data penalties of assignments (q,q+d) for q in the window of size
+/// (2*radius+1)^2 centered at p, which must be in both images.
+template <class Im, int Norm>
+inline int Match::window_penalty(Coord p, int d, int radius) const {
+    int c=0;
+    Coord q;
+    for(q.y=p.y-radius; q.y<=p.y+radius; q.y++)
+        for(q.x=p.x-radius; q.x<=p.x+radius; q.x++)
+            c += data_penalty<Im,Norm>(q, q+d);
+    return c;
+}
+
+/// Restrict the disparity range to the one of sparse matches, extended by
+/// \a margin. Pixels on a grid of step SPARSE_STEP are matched by
+/// winner-take-all of data penalties summed over windows of size
+/// (2*SPARSE_RADIUS+1)^2 in the current range. A match is kept if it is
+/// distinctive, its cost being below SPARSE_RATIO times the lowest one at
+/// disparities not adjacent to it, and if it is also the best match of the
+/// right pixel (left-right check). A fraction \a outliers of the matches is
+/// ignored at each end of the range. The range is kept if there are not
+/// enough matches.
+///
+/// Must be called after SetParameters and before GetK, since K depends on the
+/// range.
+void Match::EstimateDispRange(int margin, float outliers) {
+    if(! imLeftMin) {
+        std::cerr << "Error: EstimateDispRange needs SetParameters first!"
+                  << std::endl;
+        exit(1);
+    }
+    KERNEL_DISPATCH(estimate_disp_range, (margin, outliers));
+}
+
+/// Estimation of disparity range, see EstimateDispRange.
+template <class Im, int Norm>
+void Match::estimate_disp_range(int margin, float outliers) {
+    const int n = dispMax-dispMin+1, r=SPARSE_RADIUS;
+    std::vector<int> matches; // Disparities of kept matches
+    int samples=0;
+#ifdef _OPENMP
+#pragma omp parallel reduction(+:samples)
+#endif
+    {
+        std::vector<int> costs(n), kept;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic) nowait
+#endif
+        for(int y=r; y<imSizeL.y-r; y+=SPARSE_STEP)
+            for(int x=r; x<imSizeL.x-r; x+=SPARSE_STEP) {
+                ++samples;
+                const Coord p(x,y);
+                int best=OCCLUDED; // Disparity of lowest cost
+                for(int d=dispMin; d<=dispMax; d++) {
+                    int& c = costs[d-dispMin];
+                    c = (x-r+d<0 || x+r+d>=imSizeR.x)? // Outside right image
+                        -1: window_penalty<Im,Norm>(p, d, r);
+                    if(c>=0 && (best==OCCLUDED || c<costs[best-dispMin]))
+                        best = d;
+                }
+                if(best==OCCLUDED) continue;
+                const int cost = costs[best-dispMin];
+                bool ok=false; // Distinctive?
+                for(int d=dispMin; d<=dispMax; d++) {
+                    int c = costs[d-dispMin];
+                    if(c>=0 && std::abs(d-best)>1) {
+                        if(cost >= SPARSE_RATIO*c) { ok=false; break; }
+                        ok = true;
+                    }
+                }
+                // Left-right check: no left window matches better p+best
+                for(int d=dispMin; ok && d<=dispMax; d++) {
+                    const Coord q(x+best-d, y); // Other left pixel
+                    if(d!=best && q.x-r>=0 && q.x+r<imSizeL.x &&
+                       window_penalty<Im,Norm>(q, d, r) < cost)
+                        ok = false;
+                }
+                if(ok)
+                    kept.push_back(best);
+            }
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+        matches.insert(matches.end(), kept.begin(), kept.end());
+    }
+
+    std::ostringstream str;
+    const int num = (int)matches.size();
+    if(num < SPARSE_MIN_MATCHES) {
+        str << "Disparity range kept: " << num << " matches of " << samples
+            << " samples" << '\n';
+        log(str.str());
+        return;
+    }
+    std::sort(matches.begin(), matches.end());
+    const int k = (int)(outliers*num); // Ignored matches at each end
+    int dMin = std::max(dispMin, matches[k]-margin);
+    int dMax = std::min(dispMax, matches[num-1-k]+margin);
+    str << "Disparity range: [" << dMin-dispOffset << ',' << dMax-dispOffset
+        << "] from " << num << " matches of " << samples << " samples"
+        << " (instead of [" << dispMin-dispOffset << ','
+        << dispMax-dispOffset << "]), " << dMax-dMin+1 << " labels instead of "
+        << dispMax-dispMin+1 << '\n';
+    log(str.str());
+    SetDispRange(dMin-dispOffset, dMax-dispOffset);
+}
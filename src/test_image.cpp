@@ -0,0 +1,145 @@
+/**
+ * @file test_image.cpp
+ * @brief Test of image loading: gray detection, 16-bit and RGB expansion
+ * @author Pascal Monasse <monasse@imagine.enpc.fr>
+ *
+ * Copyright (c) 2026, Pascal Monasse
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Pulic License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "image.h"
+#include <iostream>
+#include <string>
+
+/// The fixtures in images/test are 3x3 images. Pixel i in raster order has
+/// gray value 10*i+5 in 8 bits and 7000*i+1 in 16 bits. A color pixel has
+/// channels (v,v+1,v+2) for its gray value v. Files:
+/// - gray8.png, gray16.png: gray color type;
+/// - gray_rgb8.png, gray_rgb16.png: RGB color type with gray pixels;
+/// - rgb8.png: RGB with gray rows 0-1 and color row 2;
+/// - rgb16.png: RGB with gray row 0 and color rows 1-2;
+/// - gray16.pgm: binary, max 65535;
+/// - gray_rgb8.ppm: binary, gray pixels;
+/// - rgb10.ppm: binary, max 1023, pixel i is (100*i,100*i+1,100*i+2).
+static const int W=3, H=3;
+static std::string dir; ///< Directory of fixtures
+static int errors=0; ///< Number of failed checks
+
+/// Gray value of pixel i
+static int gray8(int i)  { return 10*i+5; }
+static int gray16(int i) { return 7000*i+1; }
+
+/// Record failure of check \a ok, described by \a what
+static void check(bool ok, const std::string& what) {
+    if(! ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++errors;
+    }
+}
+
+/// Load \a file, check its size and type. Return 0 on failure.
+static GeneralImage load(const std::string& file, ImageType type,
+                         int channels=-1) {
+    std::string name = dir+'/'+file;
+    GeneralImage im = (GeneralImage)
+        (channels<0? imLoadGrayOrRGB(name.c_str()):
+         imLoad(channels==1? IMAGE_GRAY: IMAGE_RGB, name.c_str()));
+    check(im!=0, "load "+file);
+    if(! im)
+        return 0;
+    check(imGetXSize(im)==W && imGetYSize(im)==H, "size of "+file);
+    check(imGetType(im)==type, "type of "+file);
+    if(imGetType(im)!=type) {
+        imFree(im);
+        return 0;
+    }
+    return im;
+}
+
+/// Check values of gray image \a im of type \a Im against \a v.
+template <class Im>
+static void check_gray(Im im, int (*v)(int), const std::string& file) {
+    if(! im) return;
+    for(int i=0; i<W*H; i++)
+        check(imRef(im,i%W,i/W)==v(i), "pixel of "+file);
+    imFree(im);
+}
+
+/// Check values of color image \a im of type \a Im: pixels of rows from
+/// \a colorRow are (v,v+1,v+2), others (v,v,v).
+template <class Im>
+static void check_rgb(Im im, int (*v)(int), int colorRow,
+                      const std::string& file) {
+    if(! im) return;
+    for(int i=0; i<W*H; i++)
+        for(int c=0; c<3; c++) {
+            int expected = v(i) + (i/W>=colorRow? c: 0);
+            check(imRef(im,i%W,i/W).c[c]==expected, "pixel of "+file);
+        }
+    imFree(im);
+}
+
+/// Values of rgb10.ppm
+static int rgb10(int i) { return 100*i; }
+
+int main(int argc, char* argv[]) {
+    if(argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " fixtures_dir" << std::endl;
+        return 1;
+    }
+    dir = argv[1];
+
+    // Gray detection, 8 and 16 bits
+    check_gray((GrayImage)  load("gray8.png",      IMAGE_GRAY),  gray8,
+               "gray8.png");
+    check_gray((Gray16Image)load("gray16.png",     IMAGE_GRAY16),gray16,
+               "gray16.png");
+    check_gray((GrayImage)  load("gray_rgb8.png",  IMAGE_GRAY),  gray8,
+               "gray_rgb8.png");
+    check_gray((Gray16Image)load("gray_rgb16.png", IMAGE_GRAY16),gray16,
+               "gray_rgb16.png");
+    check_gray((Gray16Image)load("gray16.pgm",     IMAGE_GRAY16),gray16,
+               "gray16.pgm");
+    check_gray((GrayImage)  load("gray_rgb8.ppm",  IMAGE_GRAY),  gray8,
+               "gray_rgb8.ppm");
+
+    // Color found after gray rows: expansion of these rows to RGB
+    check_rgb((RGBImage)  load("rgb8.png",  IMAGE_RGB),   gray8,  2,
+              "rgb8.png");
+    check_rgb((RGB16Image)load("rgb16.png", IMAGE_RGB16), gray16, 1,
+              "rgb16.png");
+
+    // 10-bit PNM scaled to 16 bits
+    RGB16Image rgb = (RGB16Image)load("rgb10.ppm", IMAGE_RGB16);
+    for(int i=0; rgb && i<W*H; i++)
+        for(int c=0; c<3; c++) {
+            unsigned long v = (unsigned long)(rgb10(i)+c);
+            check(imRef(rgb,i%W,i/W).c[c]==(v*65535+511)/1023,
+                  "pixel of rgb10.ppm");
+        }
+    imFree(rgb);
+
+    // Forced number of channels: gray replicated, color to luminance
+    check_rgb((RGBImage)load("gray8.png", IMAGE_RGB, 3), gray8, H,
+              "gray8.png as RGB");
+    GrayImage gray = (GrayImage)load("rgb8.png", IMAGE_GRAY, 1);
+    const int luminance[W] = {66, 76, 86}; // Rec. 709 of last row
+    for(int i=0; gray && i<W*H; i++)
+        check(imRef(gray,i%W,i/W)==(i/W<2? gray8(i): luminance[i%W]),
+              "pixel of rgb8.png as gray");
+    imFree(gray);
+
+    if(errors)
+        std::cerr << errors << " failed checks" << std::endl;
+    else
+        std::cout << "All image loading checks passed" << std::endl;
+    return errors? 1: 0;
+}
@@ -0,0 +1,37 @@
+/**
+ * @file timer.h
+ * @brief Elapsed time measurement
+ * @author Pascal Monasse <monasse@imagine.enpc.fr>
+ *
+ * Copyright (c) 2026, Pascal Monasse
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Pulic License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#include <ctime>
+#endif
+
+/// Time in seconds from an arbitrary origin. Wall clock time if OpenMP is
+/// available, processor time otherwise (identical for a single thread).
+inline double elapsed_time() {
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    return (double)std::clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+#endif